@@ -7,6 +7,7 @@
 #include <bitset>
 #include <iomanip>
 #include <vector>
+#include <array>
 #include <optional>
 
 #include "../../mcts.h"
@@ -21,6 +22,35 @@ inline constexpr int32_t kBoardSize = 9;
 inline constexpr int32_t kMaxWidth = kBoardSize;
 inline constexpr int32_t kMaxHeight = kBoardSize;
 
+// Zobrist keys: one random key per (player, cell) and one for the side to
+// move. Generated at compile time with splitmix64 so that hash keys are the
+// same in every run.
+struct ZobristKeys {
+	static constexpr uint64_t Next(uint64_t& seed) noexcept {
+		auto z = (seed += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	constexpr ZobristKeys() noexcept
+		: stones()
+		, side(0) {
+		uint64_t seed = 0x5EED;
+		for (auto& player : stones) {
+			for (auto& key : player) {
+				key = Next(seed);
+			}
+		}
+		side = Next(seed);
+	}
+
+	std::array<std::array<uint64_t, kMaxWidth * kMaxHeight>, 2> stones;
+	uint64_t side;
+};
+
+inline constexpr ZobristKeys kZobristKeys;
+
 enum Dir {
 	kStyle3,
 	kStyle2,
@@ -39,6 +69,7 @@ public:
 		, is_terminal_(false)
 		, player_id_(kPlayerID)
         , remain_move_(kMaxWidth * kMaxHeight)
+		, hash_key_(0)
         , board_(kMaxHeight) {
         legal_moves_.reserve(kMaxWidth * kMaxHeight);
         for (auto row = 0; row < kMaxWidth; ++row) {
@@ -64,6 +95,8 @@ public:
 		else {
             board_[move.row][move.column] = kPlayer2;
 		}
+		hash_key_ ^= kZobristKeys.stones[player_id_ == kPlayerID ? 0 : 1][move.row * kMaxHeight + move.column];
+		hash_key_ ^= kZobristKeys.side;
 
 		auto result = legal_moves_.erase(move);
 		assert(result != 0);
@@ -106,6 +139,24 @@ public:
 		return player_id_;
 	}
 
+	// Zobrist key of the position, updated incrementally by ApplyMove().
+	[[nodiscard]] uint64_t GetHashKey() const noexcept {
+		return hash_key_;
+	}
+
+	// Heap memory owned by the state: the legal move set, the board rows and
+	// the map of played moves with its nodes.
+	[[nodiscard]] size_t GetHeapBytes() const noexcept {
+		auto bytes = GetHashSetBytes(legal_moves_) + board_.capacity() * sizeof(board_[0]);
+		for (const auto& row : board_) {
+			bytes += row.capacity();
+		}
+		for (const auto& player_moves : player_moves_) {
+			bytes += sizeof(player_moves) + 4 * sizeof(void*) + player_moves.second.capacity() * sizeof(GomokuGameMove);
+		}
+		return bytes;
+	}
+
 	void CheckTerminal() noexcept {
 		if (winner_exists_) {
 			return;
@@ -132,7 +183,12 @@ public:
 		std::vector<std::tuple<int32_t, GomokuGameMove, Dir>> best_moves;
 		best_moves.reserve(kMaxWidth * kMaxHeight);
 
-		for (const auto move : player_moves_.find(start)->second) {
+		const auto player_moves = player_moves_.find(start);
+		if (player_moves == player_moves_.end()) {
+			return std::nullopt;
+		}
+
+		for (const auto move : player_moves->second) {
 			auto count = AnyCount(start, move.row, move.column, 1, 0);
 			if (count >= 4) {
 				best_moves.emplace_back(count, move, kStyle1);
@@ -341,6 +397,7 @@ private:
 	bool is_terminal_;
 	int8_t player_id_;
 	int32_t remain_move_;
+	uint64_t hash_key_;
 	HashSet<GomokuGameMove> legal_moves_;
 	std::vector<std::vector<int8_t>> board_;
 	std::map<int8_t, std::vector<GomokuGameMove>> player_moves_;
@@ -348,3 +405,26 @@ private:
 };
 
 }
+
+namespace mcts {
+
+template <>
+struct MoveIndexTraits<gomoku::GomokuGameMove> {
+	static constexpr uint32_t kSize = gomoku::kMaxWidth * gomoku::kMaxHeight;
+
+	static uint32_t ToIndex(const gomoku::GomokuGameMove& move) noexcept {
+		return move.row * gomoku::kMaxHeight + move.column;
+	}
+
+	static gomoku::GomokuGameMove FromIndex(uint32_t index) noexcept {
+		return gomoku::GomokuGameMove(static_cast<int8_t>(index / gomoku::kMaxHeight),
+			static_cast<int8_t>(index % gomoku::kMaxHeight));
+	}
+};
+
+template <>
+struct UntriedMovesTraits<gomoku::GomokuGameMove> {
+	using type = BitsetMoves<gomoku::GomokuGameMove>;
+};
+
+}
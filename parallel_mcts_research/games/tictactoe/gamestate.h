@@ -140,3 +140,25 @@ private:
 };
 
 }
+
+namespace mcts {
+
+template <>
+struct MoveIndexTraits<tictactoe::TicTacToeGameMove> {
+	static constexpr uint32_t kSize = 9;
+
+	static uint32_t ToIndex(const tictactoe::TicTacToeGameMove& move) noexcept {
+		return static_cast<uint32_t>(move.index);
+	}
+
+	static tictactoe::TicTacToeGameMove FromIndex(uint32_t index) noexcept {
+		return tictactoe::TicTacToeGameMove(index);
+	}
+};
+
+template <>
+struct UntriedMovesTraits<tictactoe::TicTacToeGameMove> {
+	using type = DenseMoves<tictactoe::TicTacToeGameMove>;
+};
+
+}
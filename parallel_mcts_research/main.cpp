@@ -2,8 +2,11 @@
 
 #include <iostream>
 #include <map>
+#include <string>
 
 #include "mcts.h"
+#include "rootparallel.h"
+#include "perfcounter.h"
 #include "games/gomoku/gamestate.h"
 
 using namespace mcts;
@@ -27,6 +30,16 @@ std::map<int8_t, size_t> Simulation(int32_t count, bool is_show_game) {
 
 		if (is_show_game) {
 			std::cout << "Game start!" << std::endl;
+			const auto search_logger = [](const char* name) {
+				return [name](const SearchReport& report) {
+					std::cout << name << " search stop: " << GetStopReasonName(report.reason)
+						<< " iterations:" << report.iterations
+						<< " time:" << report.elapsed.count() << "ms"
+						<< (report.extended ? " extended" : "") << "\n";
+				};
+			};
+			ai1.SetSearchLogger(search_logger("AI1"));
+			ai2.SetSearchLogger(search_logger("AI2"));
 		}
 
 		for (auto play_count = 0; !game.IsTerminal(); ++play_count) {
@@ -39,6 +52,8 @@ std::map<int8_t, size_t> Simulation(int32_t count, bool is_show_game) {
 				}
 				game.ApplyMove(move);
 				ai1.SetOpponentMove(move);
+				// Think on ai1's time; ai2.SetOpponentMove() stops it.
+				ai2.StartPonder(rollout_tp);
 			}
 			else {
 				Move move(0, 0);
@@ -52,10 +67,13 @@ std::map<int8_t, size_t> Simulation(int32_t count, bool is_show_game) {
 				assert(game.IsLegalMove(move));
 				game.ApplyMove(move);
 				ai2.SetOpponentMove(move);
+				if (play_count > 2) {
+					ai1.StartPonder(rollout_tp);
+				}
 				if (is_show_game) {
 					if (play_count <= 2) {
 						if (play_count == 2) {
-							ai1.GetCurrentNode()->SetState(game);
+							ai1.SetCurrentState(game);
 						}
 						std::cout << "AI1 turn! " << move << "\n";
 					}					
@@ -94,8 +112,148 @@ void Gomoku(int32_t count = 1000, bool is_show_game = false) {
 	std::cout << "Tie" << " win:" << stats[State::kEmpty] << "\n";
 }
 
-int main() {
+template <typename State, typename Move, typename NodeAllocator>
+void TlbSearch(const char* name, int32_t evaluate_count) {
+	// Opened before the thread pools so the search threads inherit it.
+	TlbMissCounter counter;
+	AllocationStats stats;
+	const auto start = steady_clock::now();
+	counter.Start();
+	{
+		ThreadPool select_tp;
+		ThreadPool rollout_tp;
+		MCTS<State, Move, UCB1TunedPolicy, NodeAllocator> ai(evaluate_count, 1);
+		ai.SetOpponentMove(Move(4, 4));
+		ai.ParallelSearch(select_tp, rollout_tp, milliseconds(3600000));
+		stats = ai.GetSearchAllocationStats();
+	}
+	counter.Stop();
+	const auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+	std::cout << name << ": " << elapsed.count() << " ms, "
+		<< stats.nodes << " nodes, " << stats.bytes / (1024 * 1024) << " MB, dTLB misses: ";
+	if (counter.IsAvailable()) {
+		std::cout << counter.Read() << "\n";
+	}
+	else {
+		std::cout << "n/a\n";
+	}
+}
+
+// One long search per node allocator, reporting the data TLB misses of each.
+template <typename State, typename Move>
+void TlbBenchmark(int32_t evaluate_count) {
+	TlbSearch<State, Move, ArenaNodeAllocator>("normal pages", evaluate_count);
+	TlbSearch<State, Move, HugePageNodeAllocator>("huge pages", evaluate_count);
+	HugePageNodeAllocator allocator;
+	allocator.Allocate(1);
+	switch (allocator.GetPageMode()) {
+	case HugePageNodeAllocator::kHugeTlbPages:
+		std::cout << "huge pages from hugetlbfs\n";
+		break;
+	case HugePageNodeAllocator::kTransparentHugePages:
+		std::cout << "huge pages from MADV_HUGEPAGE\n";
+		break;
+	default:
+		std::cout << "huge pages unavailable, normal pages used\n";
+		break;
+	}
+}
+
+template <typename Move, typename Engine>
+void StrategySearch(const char* name, Engine& ai, int32_t evaluate_count) {
+	ThreadPool select_tp;
+	ThreadPool rollout_tp;
+	ai.SetOpponentMove(Move(4, 4));
+	const auto start = steady_clock::now();
+	ai.ParallelSearch(select_tp, rollout_tp, milliseconds(3600000));
+	const auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+	std::cout << name << ": " << elapsed.count() << " ms, "
+		<< evaluate_count * 1000 / (std::max)(elapsed.count(), milliseconds::rep(1)) << " iterations/s\n";
+}
+
+// One search of the same size per parallelization strategy.
+template <typename State, typename Move>
+void StrategyBenchmark(int32_t evaluate_count) {
+	constexpr int32_t kRolloutLimit = 8;
+	{
+		MCTS<State, Move, UCB1TunedPolicy, ArenaNodeAllocator, StoredNodeState, PerNodeStats, GlobalLockParallel> ai(evaluate_count, kRolloutLimit);
+		StrategySearch<Move>("global lock", ai, evaluate_count);
+	}
+	{
+		MCTS<State, Move, UCB1TunedPolicy, ArenaNodeAllocator, StoredNodeState, PerNodeStats, GlobalLockParallel> ai(evaluate_count, kRolloutLimit);
+		ai.SetSelectBatch(8);
+		StrategySearch<Move>("global lock, 8 leaves per lock", ai, evaluate_count);
+	}
+	{
+		MCTS<State, Move, UCB1TunedPolicy, ArenaNodeAllocator, StoredNodeState, SpinLockStats, SpinLockParallel> ai(evaluate_count, kRolloutLimit);
+		StrategySearch<Move>("spinlock", ai, evaluate_count);
+	}
+	{
+		MCTS<State, Move, UCB1TunedPolicy, ArenaNodeAllocator, StoredNodeState, AtomicStats, LockFreeParallel> ai(evaluate_count, kRolloutLimit);
+		StrategySearch<Move>("lock-free", ai, evaluate_count);
+	}
+	{
+		MCTS<State, Move, UCB1TunedPolicy, ArenaNodeAllocator, StoredNodeState, FixedPointStats, LockFreeParallel> ai(evaluate_count, kRolloutLimit);
+		StrategySearch<Move>("lock-free fixed point", ai, evaluate_count);
+	}
+	{
+		MCTS<State, Move, UCB1TunedPolicy, ArenaNodeAllocator, StoredNodeState, AtomicStats, PipelineParallel> ai(evaluate_count, kRolloutLimit);
+		StrategySearch<Move>("pipeline", ai, evaluate_count);
+	}
+	{
+		MCTS<State, Move, UCB1TunedPolicy, ArenaNodeAllocator, StoredNodeState, PerNodeStats, LeafParallel> ai(evaluate_count, kRolloutLimit);
+		StrategySearch<Move>("leaf", ai, evaluate_count);
+	}
+	{
+		RootParallelMCTS<State, Move, UCB1TunedPolicy> ai(std::thread::hardware_concurrency(), evaluate_count, kRolloutLimit);
+		StrategySearch<Move>("root", ai, evaluate_count);
+	}
+}
+
+template <typename Move, typename Engine>
+void MemorySearch(const char* name, Engine& ai, int32_t evaluate_count) {
+	ThreadPool rollout_tp;
+	ai.SetOpponentMove(Move(4, 4));
+	ai.Search(rollout_tp, evaluate_count, steady_clock::now() + milliseconds(3600000));
+	const auto stats = ai.GetTreeStats();
+	std::cout << name << ": " << stats.nodes << " nodes, " << stats.node_bytes << " bytes per slot, "
+		<< (stats.nodes + stats.empty_slots) * stats.node_bytes / stats.nodes << " bytes of slots and "
+		<< stats.chunk_bytes / stats.nodes << " bytes of chunks per node\n";
+}
+
+// Memory per live node of each node layout after one search of the same
+// size, counted on the slots and chunks the tree really holds.
+template <typename State, typename Move>
+void MemoryBenchmark(int32_t evaluate_count) {
+	constexpr int32_t kRolloutLimit = 8;
+	{
+		MCTS<State, Move, UCB1TunedPolicy, ArenaNodeAllocator, StoredNodeState> ai(evaluate_count, kRolloutLimit);
+		MemorySearch<Move>("stored", ai, evaluate_count);
+	}
+	{
+		MCTS<State, Move, UCB1TunedPolicy, ArenaNodeAllocator, ReplayNodeState> ai(evaluate_count, kRolloutLimit);
+		MemorySearch<Move>("replay", ai, evaluate_count);
+	}
+	{
+		MCTS<State, Move, UCB1TunedPolicy, ArenaNodeAllocator, ReplayNodeState, PackedStats> ai(evaluate_count, kRolloutLimit);
+		MemorySearch<Move>("replay, packed stats", ai, evaluate_count);
+	}
+}
+
+int main(int argc, char* argv[]) {
     using namespace gomoku;
+	if (argc > 1 && std::string(argv[1]) == "--tlb-bench") {
+		TlbBenchmark<GomokuGameState, GomokuGameMove>(argc > 2 ? std::stoi(argv[2]) : 1000000);
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--parallel-bench") {
+		StrategyBenchmark<GomokuGameState, GomokuGameMove>(argc > 2 ? std::stoi(argv[2]) : 20000);
+		return 0;
+	}
+	if (argc > 1 && std::string(argv[1]) == "--memory-bench") {
+		MemoryBenchmark<GomokuGameState, GomokuGameMove>(argc > 2 ? std::stoi(argv[2]) : 20000);
+		return 0;
+	}
 	Gomoku<GomokuGameState, GomokuGameMove>(1000, true);
 	std::cin.get();
 }
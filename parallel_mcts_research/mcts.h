@@ -6,228 +6,1439 @@
 #include <memory>
 #include <algorithm>
 #include <cassert>
+#include <stdexcept>
+#include <type_traits>
+#include <limits>
+#include <tuple>
+#include <thread>
+#include <functional>
+#include <future>
 
 
 #include "tweakme.h"
 #include "rng.h"
 #include "node.h"
+#include "nodetree.h"
+#include "nodeallocator.h"
 #include "ucbpolicy.h"
+#include "parallelpolicy.h"
+#include "nodestats.h"
+#include "subtreereclaimer.h"
+#include "boundedqueue.h"
+#include "timemanager.h"
+#include "searchhandle.h"
 
 namespace mcts {
 
 using namespace std::chrono;
 
-template <typename State, typename Move, typename UCB1Policy = DefaultUCB1Policy>
+// Stands in for the replayed board when every node stores its own State.
+struct NoReplayState {
+    NoReplayState() = default;
+
+    template <typename T>
+    explicit NoReplayState(const T&) noexcept {
+    }
+};
+
+// Size and shape of the tree below the current node.
+struct TreeStats {
+    TreeStats() noexcept
+        : nodes(0)
+        , empty_slots(0)
+        , chunk_bytes(0)
+        , heap_bytes(0)
+        , node_bytes(0)
+        , state_bytes(0)
+        , moves_bytes(0)
+        , children_bytes(0)
+        , policy_bytes(0)
+        , max_depth(0)
+        , average_depth(0)
+        , visited_once(0) {
+    }
+
+    size_t nodes;
+    // The memory figures cover the whole tree, including old subtrees not
+    // reclaimed yet, and are read from counters without waiting for the
+    // search. empty_slots are reserved for children not made yet.
+    size_t empty_slots;
+    // Bytes of the chunks in use: node slots, empty ones included, and the
+    // unused part of chunks still open for allocation.
+    size_t chunk_bytes;
+    // Heap memory owned by the node states (State::GetHeapBytes() and the
+    // untried moves), which the chunks only point to.
+    size_t heap_bytes;
+    // Bytes per node slot and how they split up. The remainder of
+    // node_bytes is the move, parent link and padding.
+    size_t node_bytes;
+    size_t state_bytes;
+    size_t moves_bytes;
+    size_t children_bytes;
+    size_t policy_bytes;
+    uint32_t max_depth;
+    double average_depth;
+    // branching[n] is the number of nodes with n children.
+    std::vector<size_t> branching;
+    // Share of nodes reached by at most one iteration.
+    double visited_once;
+};
+
+// Queue depths seen by the backpropagation stage of the last search with
+// PipelineParallel, sampled once per batch, and how often a stage found its
+// queue full or empty.
+struct PipelineStats {
+    PipelineStats() noexcept
+        : leaf_capacity(0)
+        , result_capacity(0)
+        , max_leaf_depth(0)
+        , max_result_depth(0)
+        , average_leaf_depth(0)
+        , average_result_depth(0)
+        , batches(0)
+        , select_stalls(0)
+        , rollout_stalls(0) {
+    }
+
+    size_t leaf_capacity;
+    size_t result_capacity;
+    size_t max_leaf_depth;
+    size_t max_result_depth;
+    double average_leaf_depth;
+    double average_result_depth;
+    size_t batches;
+    // Selected leaves that waited for room in the leaf queue.
+    size_t select_stalls;
+    // Polls of an empty leaf queue by rollout workers.
+    size_t rollout_stalls;
+};
+
+template
+<
+    typename State,
+    typename Move,
+    typename UCB1Policy = DefaultUCB1Policy,
+    typename NodeAllocator = ArenaNodeAllocator,
+    template <typename, typename> class NodeState = StoredNodeState,
+    template <typename> class StatsLayout = PerNodeStats,
+    typename ParallelPolicy = GlobalLockParallel
+>
 class MCTS {
 public:
     static constexpr int32_t kMaxEvaluateCount = 64;
     static constexpr int32_t kMaxRolloutCount = 128;
+    static constexpr size_t kDefaultPipelineCapacity = 64;
+    static constexpr size_t kBackPropBatchSize = 64;
+    static constexpr int32_t kSearchCheckInterval = 64;
+    static constexpr double kDefaultSearchExtension = 0.5;
+    static constexpr int32_t kDefaultSelectBatch = 1;
+
+    // PerNodeStats keeps a UCB1Policy in every node, PackedStats keeps the
+    // statistics of siblings in contiguous columns of the tree and
+    // TranspositionStats shares one record between nodes of the same position.
+    using stats_type = StatsLayout<UCB1Policy>;
+    using parallel_policy_type = ParallelPolicy;
+    using node_type = Node<State, Move, typename stats_type::node_stats_type, NodeState<State, Move>>;
+    using tree_type = NodeTree<node_type, NodeAllocator, stats_type::kColumns>;
+    using node_view_type = NodeView<const tree_type, stats_type>;
+
+    // Board that Select/Expand replay moves into when nodes keep no State.
+    using replay_state_type = std::conditional_t<node_type::kStoresState, NoReplayState, State>;
+
+    using move_type = Move;
 
-    using node_type = Node<State, Move, UCB1Policy>;
-    using node_ptr_type = typename Node<State, Move, UCB1Policy>::ptr_type;
-    using children_vector_type = std::vector<node_ptr_type>;
+    // Synchronization only the strategies that need it have; see
+    // parallelpolicy.h.
+    using root_mutex_type = std::conditional_t<ParallelPolicy::kLocksTree, FastMutex, NullMutex>;
+    using structure_mutex_type = std::conditional_t<ParallelPolicy::kSingleWalker, NullMutex, FastMutex>;
+    using in_flight_type = std::conditional_t<ParallelPolicy::kLocksTree, int32_t, NullCounter>;
+
+    using progress_callback_type = std::function<void(const SearchProgress<Move>&)>;
 
     MCTS(int32_t evaluate_count = kMaxEvaluateCount, int32_t rollout_limit = kMaxRolloutCount);
 
     explicit MCTS(const State& state, int32_t evaluate_count = kMaxEvaluateCount, int32_t rollout_limit = kMaxRolloutCount);
 
-    MCTS(const MCTS&) = default;
-    MCTS& operator=(const MCTS &) = default;
+    ~MCTS();
+
+    MCTS(const MCTS&) = delete;
+    MCTS& operator=(const MCTS &) = delete;
 
     void SetSearchLimit(int32_t evaluate_count, int32_t rollout_limit);
 
+    // Caps the number of live nodes. Once the tree reaches the budget the
+    // search stops expanding and evicts the least visited subtrees until a
+    // quarter of the budget is free again.
+    void SetNodeBudget(size_t max_nodes) noexcept;
+
+    // Caps the memory of the tree: the chunks in use, empty slots included,
+    // and the heap owned by node states (State::GetHeapBytes()). A node is
+    // only expanded while one more chunk fits, so the tree stays below
+    // max_bytes plus the heap of one node per expanding thread. Eviction
+    // aims at a quarter of the budget free counting one slot and the heap
+    // of every live node. A chunk is only freed once all its nodes are
+    // gone, so the search may run without expanding until chunks free up.
+    void SetByteBudget(size_t max_bytes) noexcept;
+
+    // Searches with the strategy chosen by ParallelPolicy (parallelpolicy.h).
+    // SpinLockParallel, LockFreeParallel and PipelineParallel need a
+    // concurrent stats layout, SpinLockStats and AtomicStats or
+    // FixedPointStats respectively. The strategies that walk the tree
+    // concurrently evict before the search starts and otherwise stop
+    // expanding at the node budget. With PipelineParallel the stages are
+    // sized by their pools and talk through lock-free bounded queues.
     Move ParallelSearch(ThreadPool &select_tp, ThreadPool &rollout_tp, milliseconds search_time = milliseconds(30000));
 
+    // Every search stops at evaluate_count iterations or search_time, or
+    // earlier once no child can overtake the best one in what is left of
+    // both. If the best child changed at the last check when the budget runs
+    // out, the budget and the time are extended once by this share.
+    void SetSearchExtension(double extension) noexcept;
+
+    // Batched selection for the strategies that do not walk the tree
+    // concurrently. A select thread selects and expands up to leaves leaves
+    // under one lock, with virtual loss steering every selection off the
+    // paths taken before it, plays them all out in one pass over rollout_tp
+    // without the lock, and backpropagates them under one more lock. 1, the
+    // default, runs one iteration per lock. Seeded mode and pondering do not
+    // batch.
+    void SetSelectBatch(int32_t leaves) noexcept;
+
+    // Seeded mode: iteration n after SetSeed() draws its selection and
+    // expansion from stream (seed, n) and its k-th playout from stream
+    // (seed, n, k + 1). Iterations then run one at a time in order, with only
+    // their playouts in parallel, so ParallelSearch, SearchAsync and Search
+    // build the same tree whatever the thread count. Pondering runs seeded
+    // iterations too, but how many depends on time. PipelineParallel
+    // searches are not seeded.
+    void SetSeed(uint64_t seed) noexcept;
+
+    void ClearSeed() noexcept;
+
+    [[nodiscard]] bool IsSeeded() const noexcept;
+
+    // Called with the report of every finished search.
+    void SetSearchLogger(std::function<void(const SearchReport&)> logger);
+
+    [[nodiscard]] SearchReport GetSearchReport() const noexcept;
+
+    // Capacity of each PipelineParallel queue.
+    void SetPipelineCapacity(size_t capacity) noexcept;
+
+    [[nodiscard]] PipelineStats GetPipelineStats() const noexcept;
+
+    // Starts a search like ParallelSearch() on a thread of its own and returns
+    // at once. progress is called from a search thread every
+    // budget.progress_interval. Only one search may run at a time.
+    SearchHandle<Move> SearchAsync(ThreadPool& select_tp,
+                                   ThreadPool& rollout_tp,
+                                   const SearchBudget& budget,
+                                   progress_callback_type progress = nullptr);
+
+    // Stops the running search, including its rollouts, and lets it play the
+    // best move found so far.
+    void Cancel() noexcept;
+
+    // Runs up to iterations iterations on the calling thread, stopping early
+    // at deadline, and returns how many ran. Leaves the current node where it
+    // is; RootParallelMCTS drives one engine per worker this way.
+    int32_t Search(ThreadPool& rollout_tp, int32_t iterations, steady_clock::time_point deadline);
+
+    // Plays the best visited child of the current node and returns its
+    // move, or throws std::logic_error if no child was visited. Ends a
+    // search driven through Search(), e.g. by SearchService.
+    Move PlayBestMove();
+
+    // Merges rewards into the child of the current node reached by move and
+    // into the current node. Returns false if that child does not exist.
+    bool AddChildStats(const Move& move, const RewardStats& rewards);
+
+    // Keeps searching from the current node on a background thread, e.g.
+    // during the opponent's turn, until StopPonder(). SetOpponentMove(),
+    // SetCurrentState() and the searches stop pondering first, and the
+    // subtree it grew below the opponent's move is kept. Only rollouts go to
+    // rollout_tp, so the select pool stays free for the other engine.
+    void StartPonder(ThreadPool& rollout_tp);
+
+    // Aborts the playout in flight and drops it, so the caller does not wait
+    // for a whole rollout.
+    void StopPonder();
+
+    [[nodiscard]] bool IsPondering() const noexcept;
+
     void SetOpponentMove(const Move& opponent_move);
 
-	const node_ptr_type& GetCurrentNode() const;
+    // Replaces the board of the current node, e.g. after moves were played
+    // without telling the engine.
+    void SetCurrentState(const State& state);
+
+	[[nodiscard]] node_view_type GetCurrentNode() const noexcept;
+
+    [[nodiscard]] typename node_view_type::Range GetChildren() const noexcept;
+
+    [[nodiscard]] double GetWinRate() const;
+
+    // Bytes and nodes the tree allocated during the last ParallelSearch.
+    [[nodiscard]] AllocationStats GetSearchAllocationStats() const noexcept;
+
+    // Walks the tree below the current node. Safe to call from another
+    // thread during a search, except with LeafParallel and RootParallel,
+    // which take no lock. The walk never waits for an iteration, only for
+    // evictions and re-rooting. Layouts that are not concurrent only report
+    // visited_once when no iteration holds root_mutex_, NaN otherwise.
+    [[nodiscard]] TreeStats GetTreeStats() const;
 
 private:
-    node_ptr_type GetBestChild(const node_ptr_type& parent) const;
+    // Re-roots the tree at node and hands the rest of the old tree to the
+    // reclaimer thread.
+    void Advance(NodeIndex node);
+
+    // Plays the best child of the current node after a search.
+    Move CommitBestMove(const AllocationStats& start_stats);
+
+    // Body of ParallelSearch and SearchAsync, one per kind of strategy. They
+    // leave cancelled_ alone, so a Cancel() before SearchAsync's thread
+    // starts still counts.
+    Move RunSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, const SearchBudget& budget, const progress_callback_type& progress);
+
+    Move RunParallelSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, const SearchBudget& budget, const progress_callback_type& progress);
+
+    Move RunTreeParallelSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, const SearchBudget& budget, const progress_callback_type& progress);
+
+    Move RunPipelinedSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, const SearchBudget& budget, const progress_callback_type& progress);
+
+    // Locks root_mutex_ if ParallelPolicy runs iterations under it.
+    std::unique_lock<root_mutex_type> LockTree() const;
+
+    // Count the iterations between selection and backpropagation, under
+    // root_mutex_, so that the evicted ranges are destroyed once the last of
+    // them is done. Only kLocksTree strategies keep the count; the others
+    // have one walker or evict outside the iterations.
+    void StartIterations(int32_t count) noexcept;
+
+    void FinishIterations(int32_t count) noexcept;
+
+    // One select, expand, rollout and backpropagation, under root_mutex_
+    // with GlobalLockParallel. Rollouts are scored for player_id.
+    void Iterate(ThreadPool& rollout_tp, int8_t player_id);
+
+    // Same without the lock, for concurrent stats layouts.
+    void IterateLockFree(ThreadPool& rollout_tp, int8_t player_id);
+
+    // Selects, expands, plays out and backpropagates leaves leaves with one
+    // lock for the selection and one for the backpropagation.
+    void IterateBatch(ThreadPool& rollout_tp, int32_t leaves, int8_t player_id);
+
+    // Runs one worker loop per select thread. The workers take up to batch
+    // iterations at a time from a time manager until it stops the search,
+    // and pass how many they got to iteration.
+    template <typename Iteration>
+    void RunWorkers(ThreadPool& select_tp, const SearchBudget& budget, int32_t batch, const progress_callback_type& progress, Iteration&& iteration);
+
+    void ReportProgress(const TimeManager& time_manager, size_t start_nodes, const progress_callback_type& progress);
+
+    // Tells the time manager the best child of the current node and whether
+    // any other child can still overtake it.
+    void CheckProgress(TimeManager& time_manager);
+
+    void FinishSearch(const TimeManager& time_manager);
+
+    double GetWinRate(NodeIndex node) const;
 
-    node_ptr_type GetBestUCBChild(const node_ptr_type& parent) const;
+    // The visited child of parent with the best win rate, or
+    // kInvalidNodeIndex if no child was visited.
+    NodeIndex GetBestChild(NodeIndex parent) const;
 
-    node_ptr_type Select() const;
+    NodeIndex GetBestUCBChild(NodeIndex parent) const;
 
-    node_ptr_type Expand(node_ptr_type& node);
+    NodeIndex Select(replay_state_type& state);
 
-    double Rollout(const node_ptr_type& leaf, ThreadPool& rollout_tp);
+    NodeIndex Expand(NodeIndex parent, replay_state_type& state);
 
-    void BackPropagation(const node_ptr_type& leaf, double score);
+    NodeIndex MakeChild(NodeIndex parent, const Move& move, replay_state_type& state);
 
-	std::atomic<bool> cancelled_;
+    Move TakeUntriedMove(NodeIndex parent, const replay_state_type& state);
+
+    const State& GetLeafState(NodeIndex leaf, const replay_state_type& state) const;
+
+    // Plays out leaf_state rollout_limit_ times over rollout_tp and scores
+    // the games for player_id. The rewards are added in playout order, so
+    // seeded searches get the same statistics whatever the thread count.
+    RewardStats Rollout(const State& leaf_state, int8_t player_id, ThreadPool& rollout_tp);
+
+    // Plays out every leaf in leaf_states in one pass over rollout_tp and
+    // stores the rewards of leaf i in rewards[i].
+    void Rollout(const std::vector<const State*>& leaf_states, int8_t player_id, std::vector<RewardStats>& rewards, ThreadPool& rollout_tp);
+
+    // Seeds the calling thread's RNG for the next iteration in seeded mode.
+    // Returns the stream of the iteration.
+    uint64_t SeedIteration();
+
+    // Plays one random game from leaf_state and scores it for player_id.
+    // Gives up half way once the search is cancelled or pondering stops.
+    double Playout(const State& leaf_state, int8_t player_id) const;
+
+    // True once the search is cancelled or StopPonder() waits for the
+    // ponder thread; the running iterations are then dropped.
+    [[nodiscard]] bool IsStopping() const noexcept;
+
+    void BackPropagation(NodeIndex leaf, const RewardStats& rewards);
+
+    // Takes back the virtual loss of an iteration whose result was dropped.
+    void AbandonPath(NodeIndex leaf);
+
+    [[nodiscard]] bool IsOverBudget() const noexcept;
+
+    // Drops the children of the least visited nodes below the current node.
+    // The dropped ranges are destroyed by ReleaseEvicted() once no selected
+    // leaf waits for its backpropagation.
+    void EvictSubtrees();
+
+    void ReleaseEvicted() noexcept;
+
+    std::atomic<bool> cancelled_;
+    std::atomic<bool> pondering_;
+    // Set by StopPonder() while it joins the ponder thread, apart from
+    // cancelled_ so that a Cancel() in the meantime is kept.
+    std::atomic<bool> ponder_aborted_;
+    bool seeded_;
+    uint64_t seed_;
+    // Iterations run since SetSeed(); the stream of the next one.
+    uint64_t seed_iteration_;
     int32_t evaluate_count_;
     int32_t rollout_limit_;
-    node_ptr_type root_;
-    node_ptr_type current_node_;
-    FastMutex root_mutex_;
+    // Log and 1 / sqrt tables for visits in multiples of rollout_limit_.
+    const VisitTables* visit_tables_;
+    // Iterations between selection and backpropagation, with kLocksTree.
+    in_flight_type in_flight_;
+    int32_t select_batch_;
+    size_t node_budget_;
+    size_t byte_budget_;
+    size_t pipeline_capacity_;
+    double search_extension_;
+    AllocationStats search_allocation_stats_;
+    PipelineStats pipeline_stats_;
+    SearchReport search_report_;
+    std::function<void(const SearchReport&)> search_logger_;
+    stats_type stats_;
+    tree_type tree_;
+    NodeIndex current_node_;
+    replay_state_type current_state_;
+    mutable root_mutex_type root_mutex_;
+    // Held while nodes below the current node are dropped or the tree is
+    // re-rooted, so GetTreeStats() can walk it without root_mutex_.
+    mutable structure_mutex_type structure_mutex_;
+    std::vector<std::pair<NodeIndex, uint32_t>> evicted_ranges_;
+    std::thread ponder_thread_;
+    SubtreeReclaimer<tree_type> reclaimer_;
 };
 
-template <typename State, typename Move, typename UCB1Policy>
-MCTS<State, Move, UCB1Policy>::MCTS(int32_t evaluate_count, int32_t rollout_limit)
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::MCTS(int32_t evaluate_count, int32_t rollout_limit)
     : cancelled_(false)
+    , pondering_(false)
+    , ponder_aborted_(false)
+    , seeded_(false)
+    , seed_(0)
+    , seed_iteration_(0)
 	, evaluate_count_(evaluate_count)
     , rollout_limit_(rollout_limit)
-    , root_(std::make_shared<Node<State, Move, UCB1Policy>>())
-    , current_node_(root_) {
+    , visit_tables_(&VisitTables::Get(rollout_limit))
+    , in_flight_()
+    , select_batch_(kDefaultSelectBatch)
+    , node_budget_((std::numeric_limits<size_t>::max)())
+    , byte_budget_((std::numeric_limits<size_t>::max)())
+    , pipeline_capacity_(kDefaultPipelineCapacity)
+    , search_extension_(kDefaultSearchExtension)
+    , current_node_(tree_.MakeRoot())
+    , current_state_(State())
+    , reclaimer_(tree_) {
+    stats_.Attach(tree_, current_node_, State());
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-MCTS<State, Move, UCB1Policy>::MCTS(const State &state, int32_t evaluate_count, int32_t rollout_limit)
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::MCTS(const State &state, int32_t evaluate_count, int32_t rollout_limit)
     : cancelled_(false)
+    , pondering_(false)
+    , ponder_aborted_(false)
+    , seeded_(false)
+    , seed_(0)
+    , seed_iteration_(0)
 	, evaluate_count_(evaluate_count)
     , rollout_limit_(rollout_limit)
-    , root_(std::make_shared<Node<State, Move, UCB1Policy>>(state))
-    , current_node_(root_) {
+    , visit_tables_(&VisitTables::Get(rollout_limit))
+    , in_flight_()
+    , select_batch_(kDefaultSelectBatch)
+    , node_budget_((std::numeric_limits<size_t>::max)())
+    , byte_budget_((std::numeric_limits<size_t>::max)())
+    , pipeline_capacity_(kDefaultPipelineCapacity)
+    , search_extension_(kDefaultSearchExtension)
+    , current_node_(tree_.MakeRoot(state))
+    , current_state_(state)
+    , reclaimer_(tree_) {
+    stats_.Attach(tree_, current_node_, state);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::~MCTS() {
+    StopPonder();
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-void MCTS<State, Move, UCB1Policy>::SetSearchLimit(int32_t evaluate_count, int32_t rollout_limit) {
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SetSearchLimit(int32_t evaluate_count, int32_t rollout_limit) {
     evaluate_count_ = evaluate_count;
     rollout_limit_ = rollout_limit;
+    visit_tables_ = &VisitTables::Get(rollout_limit);
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-const typename MCTS<State, Move, UCB1Policy>::node_ptr_type& MCTS<State, Move, UCB1Policy>::GetCurrentNode() const {
-    return current_node_;
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SetNodeBudget(size_t max_nodes) noexcept {
+    node_budget_ = max_nodes;
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-typename MCTS<State, Move, UCB1Policy>::node_ptr_type MCTS<State, Move, UCB1Policy>::GetBestUCBChild(const node_ptr_type
-	& parent) const {
-    const auto& candidate_node = parent->GetChildren();
-    auto itr = std::max_element(candidate_node.cbegin(), candidate_node.cend(), [](
-                                const auto& first,
-                                const auto& last) noexcept {
-        return first->GetUCB() > last->GetUCB();
-    });
-    return *itr;
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SetByteBudget(size_t max_bytes) noexcept {
+    byte_budget_ = max_bytes;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SetSearchExtension(double extension) noexcept {
+    search_extension_ = extension;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SetSelectBatch(int32_t leaves) noexcept {
+    select_batch_ = (std::max)(leaves, 1);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SetSeed(uint64_t seed) noexcept {
+    seeded_ = true;
+    seed_ = seed;
+    seed_iteration_ = 0;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::ClearSeed() noexcept {
+    seeded_ = false;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+bool MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::IsSeeded() const noexcept {
+    return seeded_;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+uint64_t MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SeedIteration() {
+    const auto stream = seed_iteration_++;
+    RNG::Get().Seed(RNG::GetStreamSeed(seed_, stream));
+    return stream;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SetSearchLogger(std::function<void(const SearchReport&)> logger) {
+    search_logger_ = std::move(logger);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+SearchReport MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetSearchReport() const noexcept {
+    return search_report_;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SetPipelineCapacity(size_t capacity) noexcept {
+    pipeline_capacity_ = capacity;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+PipelineStats MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetPipelineStats() const noexcept {
+    return pipeline_stats_;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+typename MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::node_view_type MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetCurrentNode() const noexcept {
+    return node_view_type(&tree_, current_node_);
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-typename MCTS<State, Move, UCB1Policy>::node_ptr_type MCTS<State, Move, UCB1Policy>::GetBestChild(const node_ptr_type& parent) const {
-    const auto& candidate_node = parent->GetChildren();
-    auto itr = std::max_element(candidate_node.cbegin(), candidate_node.cend(),
-                                [](
-								const auto& large,
-                                const auto& node) noexcept {
-		return node->GetWinRate() > large->GetWinRate();
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+typename MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::node_view_type::Range MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetChildren() const noexcept {
+    return GetCurrentNode().GetChildren();
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+double MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetWinRate() const {
+    return GetCurrentNode()->GetWinRate();
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SetCurrentState(const State& state) {
+    StopPonder();
+    auto& node = tree_[current_node_];
+    const auto heap_bytes = node.GetHeapBytes();
+    node.SetState(state);
+    tree_.UpdateHeapBytes(heap_bytes, node.GetHeapBytes());
+    stats_.Attach(tree_, current_node_, state);
+    if constexpr (!node_type::kStoresState) {
+        current_state_ = state;
+    }
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+AllocationStats MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetSearchAllocationStats() const noexcept {
+    return search_allocation_stats_;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::Advance(NodeIndex node) {
+    std::lock_guard guard{ root_mutex_ };
+    std::lock_guard structure_guard{ structure_mutex_ };
+    current_node_ = node;
+    reclaimer_.Reclaim(tree_.Reroot(node), node);
+    tree_.RetireOpenChunks();
+    stats_.Purge();
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+double MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetWinRate(NodeIndex node) const {
+    return stats_.GetScore(tree_, node) / static_cast<double>(stats_.GetVisits(tree_, node));
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+TreeStats MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetTreeStats() const {
+    TreeStats stats;
+    stats.node_bytes = tree_type::kChunkBytes / tree_type::kChunkSize;
+    stats.state_bytes = node_type::kStoresState ? sizeof(State) : 0;
+    stats.moves_bytes = sizeof(NodeState<State, Move>) - stats.state_bytes;
+    stats.children_bytes = 2 * sizeof(NodeIndex) + sizeof(uint32_t);
+    stats.policy_bytes = stats_type::kColumns * sizeof(uint64_t);
+    if constexpr (!std::is_empty_v<typename stats_type::node_stats_type>) {
+        stats.policy_bytes += sizeof(typename stats_type::node_stats_type);
+    }
+
+    stats.empty_slots = tree_.GetEmptySlotCount();
+    stats.chunk_bytes = tree_.GetChunkCount() * tree_type::kChunkBytes;
+    stats.heap_bytes = tree_.GetHeapBytes();
+
+    std::lock_guard guard{ structure_mutex_ };
+    std::unique_lock stats_lock{ root_mutex_, std::defer_lock };
+    if constexpr (!stats_type::kConcurrent) {
+        stats_lock.try_lock();
+    }
+    const auto read_visits = stats_type::kConcurrent || stats_lock.owns_lock();
+    size_t total_depth = 0;
+    size_t visited_once = 0;
+    std::vector<std::pair<NodeIndex, uint32_t>> pending{ { current_node_, 0 } };
+    while (!pending.empty()) {
+        const auto [index, depth] = pending.back();
+        pending.pop_back();
+        const auto& node = tree_[index];
+        const auto children_size = node.GetChildrenSize();
+        ++stats.nodes;
+        total_depth += depth;
+        stats.max_depth = (std::max)(stats.max_depth, depth);
+        if (stats.branching.size() <= children_size) {
+            stats.branching.resize(children_size + 1);
+        }
+        ++stats.branching[children_size];
+        // Every backpropagation adds rollout_limit_ visits.
+        if (read_visits && stats_.GetVisits(tree_, index) <= rollout_limit_) {
+            ++visited_once;
+        }
+        for (auto child : tree_.GetChildRange(node.GetFirstChild(), children_size)) {
+            pending.emplace_back(child, depth + 1);
+        }
+    }
+    stats.average_depth = static_cast<double>(total_depth) / static_cast<double>(stats.nodes);
+    stats.visited_once = read_visits
+        ? static_cast<double>(visited_once) / static_cast<double>(stats.nodes)
+        : std::numeric_limits<double>::quiet_NaN();
+    return stats;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+NodeIndex MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetBestUCBChild(NodeIndex parent) const {
+    const auto& parent_node = tree_[parent];
+    const auto children_size = parent_node.GetChildrenSize();
+    return stats_.SelectChild(tree_,
+                              *visit_tables_,
+                              parent_node.GetFirstChild(),
+                              children_size,
+                              stats_.GetVisits(tree_, parent));
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+NodeIndex MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetBestChild(NodeIndex parent) const {
+    // Children of abandoned iterations have no win rate to compare.
+    auto best = kInvalidNodeIndex;
+    for (auto child : tree_.GetChildren(parent)) {
+        if (stats_.GetVisits(tree_, child) == 0) {
+            continue;
+        }
+        if (best == kInvalidNodeIndex || GetWinRate(child) > GetWinRate(best)) {
+            best = child;
+        }
+    }
+    return best;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+Move MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::ParallelSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, milliseconds search_time) {
+    cancelled_ = false;
+    return RunSearch(select_tp, rollout_tp, SearchBudget(evaluate_count_, search_time), nullptr);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+Move MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::RunSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, const SearchBudget& budget, const progress_callback_type& progress) {
+    if constexpr (ParallelPolicy::kPipelined) {
+        return RunPipelinedSearch(select_tp, rollout_tp, budget, progress);
+    }
+    else if constexpr (ParallelPolicy::kConcurrentTree) {
+        return RunTreeParallelSearch(select_tp, rollout_tp, budget, progress);
+    }
+    else {
+        return RunParallelSearch(select_tp, rollout_tp, budget, progress);
+    }
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+Move MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::RunParallelSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, const SearchBudget& budget, const progress_callback_type& progress) {
+    StopPonder();
+    const auto start_stats = tree_.GetStats();
+    const auto player_id = tree_[current_node_].GetPlayerID();
+    RunWorkers(select_tp, budget, seeded_ ? 1 : select_batch_, progress, [this, &rollout_tp, player_id](int32_t leaves) {
+        if (leaves == 1) {
+            Iterate(rollout_tp, player_id);
+        }
+        else {
+            IterateBatch(rollout_tp, leaves, player_id);
+        }
     });
-    return *itr;
+    return CommitBestMove(start_stats);
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-Move MCTS<State, Move, UCB1Policy>::ParallelSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, milliseconds search_time) {
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+SearchHandle<Move> MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SearchAsync(ThreadPool& select_tp, ThreadPool& rollout_tp, const SearchBudget& budget, progress_callback_type progress) {
     cancelled_ = false;
-    auto start_tp = steady_clock::now();
-    mcts::ParallelFor(select_tp, evaluate_count_, [this, start_tp, search_time, &rollout_tp](int32_t) {
-        cancelled_ = duration_cast<milliseconds>(steady_clock::now() - start_tp) > search_time;
-        if (cancelled_) {
+    auto search_budget = budget;
+    if (search_budget.iterations == 0) {
+        search_budget.iterations = evaluate_count_;
+    }
+    auto result = std::async(std::launch::async, [this, &select_tp, &rollout_tp, search_budget, progress = std::move(progress)]() {
+        return RunSearch(select_tp, rollout_tp, search_budget, progress);
+    });
+    return SearchHandle<Move>(std::move(result), &cancelled_);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::Cancel() noexcept {
+    cancelled_ = true;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+template <typename Iteration>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::RunWorkers(ThreadPool& select_tp, const SearchBudget& budget, int32_t batch, const progress_callback_type& progress, Iteration&& iteration) {
+    TimeManager time_manager(budget.iterations, budget.time, search_extension_, &cancelled_);
+    const auto start_nodes = tree_.GetStats().nodes;
+    const auto workers = ParallelPolicy::kSingleWalker || seeded_
+        ? 1 : static_cast<int32_t>((std::max)(select_tp.GetThreadCount(), size_t(1)));
+    mcts::ParallelFor(select_tp, workers, [&, this](int32_t) {
+        int32_t i = 0;
+        while (time_manager.Next(i)) {
+            auto check = (i + 1) % kSearchCheckInterval == 0;
+            auto leaves = 1;
+            while (leaves < batch && time_manager.Next(i)) {
+                check = check || (i + 1) % kSearchCheckInterval == 0;
+                ++leaves;
+            }
+            if (seeded_) {
+                SeedIteration();
+            }
+            iteration(leaves);
+            if (check) {
+                CheckProgress(time_manager);
+            }
+            if (progress && time_manager.IsProgressDue(budget.progress_interval)) {
+                ReportProgress(time_manager, start_nodes, progress);
+            }
+        }
+    });
+    FinishSearch(time_manager);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::ReportProgress(const TimeManager& time_manager, size_t start_nodes, const progress_callback_type& progress) {
+    SearchProgress<Move> info;
+    {
+        std::unique_lock lock{ root_mutex_, std::defer_lock };
+        if constexpr (!stats_type::kConcurrent && ParallelPolicy::kLocksTree) {
+            lock.lock();
+        }
+        const auto best = GetBestChild(current_node_);
+        if (best != kInvalidNodeIndex) {
+            info.has_best_move = true;
+            info.best_move = tree_[best].GetLastMove();
+            info.win_rate = GetWinRate(best);
+        }
+    }
+    const auto report = time_manager.GetReport();
+    info.iterations = report.iterations;
+    info.elapsed = report.elapsed;
+    if (report.elapsed.count() > 0) {
+        info.nodes_per_second = static_cast<double>(tree_.GetStats().nodes - start_nodes) * 1000.0
+            / static_cast<double>(report.elapsed.count());
+    }
+    progress(info);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::CheckProgress(TimeManager& time_manager) {
+    std::unique_lock lock{ root_mutex_, std::defer_lock };
+    if constexpr (!stats_type::kConcurrent && ParallelPolicy::kLocksTree) {
+        lock.lock();
+    }
+    const auto& root = tree_[current_node_];
+    const auto children_size = root.GetChildrenSize();
+    if (children_size == 0) {
+        return;
+    }
+    const auto best = GetBestChild(current_node_);
+    if (best == kInvalidNodeIndex) {
+        return;
+    }
+    const auto best_visits = static_cast<double>(stats_.GetVisits(tree_, best));
+    if (best_visits == 0) {
+        return;
+    }
+    // In the worst case every remaining rollout is a loss for the best child
+    // or a win for one other child. An untried move may still beat both.
+    const auto remaining = static_cast<double>(time_manager.GetRemainingIterations()) * rollout_limit_;
+    const auto best_floor = stats_.GetScore(tree_, best) / (best_visits + remaining);
+    auto decided = !root.HasPassibleMoves();
+    for (auto child : tree_.GetChildRange(root.GetFirstChild(), children_size)) {
+        if (!decided) {
+            break;
+        }
+        const auto ceiling = (stats_.GetScore(tree_, child) + remaining)
+            / (static_cast<double>(stats_.GetVisits(tree_, child)) + remaining);
+        decided = child == best || ceiling < best_floor;
+    }
+    time_manager.Report(best, decided);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::FinishSearch(const TimeManager& time_manager) {
+    search_report_ = time_manager.GetReport();
+    if (search_logger_) {
+        search_logger_(search_report_);
+    }
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+std::unique_lock<typename MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::root_mutex_type> MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::LockTree() const {
+    if constexpr (ParallelPolicy::kLocksTree) {
+        return std::unique_lock{ root_mutex_ };
+    }
+    else {
+        return {};
+    }
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::StartIterations(int32_t count) noexcept {
+    if constexpr (ParallelPolicy::kLocksTree) {
+        in_flight_ += count;
+    }
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::FinishIterations(int32_t count) noexcept {
+    if constexpr (ParallelPolicy::kLocksTree) {
+        in_flight_ -= count;
+        if (in_flight_ != 0) {
             return;
         }
-        node_ptr_type selected_leaf;
-        {
-            std::lock_guard guard{ root_mutex_ };
-            auto selected_parent = Select();
-            selected_leaf = Expand(selected_parent);
+    }
+    ReleaseEvicted();
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::Iterate(ThreadPool& rollout_tp, int8_t player_id) {
+    NodeIndex selected_leaf;
+    auto state = current_state_;
+    {
+        const auto lock = LockTree();
+        if (IsOverBudget() && evicted_ranges_.empty()) {
+            EvictSubtrees();
+        }
+        selected_leaf = Expand(Select(state), state);
+        StartIterations(1);
+    }
+    const auto lock = LockTree();
+    const auto rewards = Rollout(GetLeafState(selected_leaf, state), player_id, rollout_tp);
+    if (IsStopping()) {
+        AbandonPath(selected_leaf);
+    }
+    else {
+        BackPropagation(selected_leaf, rewards);
+    }
+    FinishIterations(1);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::IterateBatch(ThreadPool& rollout_tp, int32_t leaves, int8_t player_id) {
+    std::vector<replay_state_type> states(leaves, current_state_);
+    std::vector<NodeIndex> selected_leaves(leaves);
+    std::vector<const State*> leaf_states(leaves);
+    std::vector<RewardStats> rewards(leaves);
+    {
+        const auto lock = LockTree();
+        if (IsOverBudget() && evicted_ranges_.empty()) {
+            EvictSubtrees();
+        }
+        for (auto i = 0; i < leaves; ++i) {
+            selected_leaves[i] = Expand(Select(states[i]), states[i]);
+            // Concurrent layouts took their virtual loss on the way down.
+            if constexpr (!stats_type::kConcurrent) {
+                for (auto node = selected_leaves[i]; node != kInvalidNodeIndex; node = tree_[node].GetParent()) {
+                    stats_.AddVirtualLoss(tree_, node, rollout_limit_);
+                }
+            }
+            leaf_states[i] = &GetLeafState(selected_leaves[i], states[i]);
+        }
+        StartIterations(leaves);
+    }
+    Rollout(leaf_states, player_id, rewards, rollout_tp);
+    const auto lock = LockTree();
+    for (auto i = 0; i < leaves; ++i) {
+        if constexpr (!stats_type::kConcurrent) {
+            for (auto node = selected_leaves[i]; node != kInvalidNodeIndex; node = tree_[node].GetParent()) {
+                stats_.RemoveVirtualLoss(tree_, node, rollout_limit_);
+            }
         }
-        std::lock_guard guard{ root_mutex_ };
-        auto score = Rollout(selected_leaf, rollout_tp);
-        BackPropagation(selected_leaf, score);
+        if (IsStopping()) {
+            AbandonPath(selected_leaves[i]);
+        }
+        else {
+            BackPropagation(selected_leaves[i], rewards[i]);
+        }
+    }
+    FinishIterations(leaves);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+int32_t MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::Search(ThreadPool& rollout_tp, int32_t iterations, steady_clock::time_point deadline) {
+    cancelled_ = false;
+    const auto player_id = tree_[current_node_].GetPlayerID();
+    for (int32_t i = 0; i < iterations; ++i) {
+        if (steady_clock::now() > deadline) {
+            return i;
+        }
+        if (seeded_) {
+            SeedIteration();
+        }
+        Iterate(rollout_tp, player_id);
+    }
+    return iterations;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+bool MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::AddChildStats(const Move& move, const RewardStats& rewards) {
+    std::lock_guard guard{ root_mutex_ };
+    for (auto child : tree_.GetChildren(current_node_)) {
+        if (tree_[child].GetLastMove() == move) {
+            stats_.Update(tree_, child, rewards);
+            stats_.Update(tree_, current_node_, rewards);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+Move MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::RunTreeParallelSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, const SearchBudget& budget, const progress_callback_type& progress) {
+    static_assert(stats_type::kConcurrent, "SpinLockParallel and LockFreeParallel need a concurrent stats layout such as AtomicStats");
+    StopPonder();
+    if (IsOverBudget()) {
+        EvictSubtrees();
+        ReleaseEvicted();
+    }
+    const auto start_stats = tree_.GetStats();
+    const auto player_id = tree_[current_node_].GetPlayerID();
+    RunWorkers(select_tp, budget, 1, progress, [this, &rollout_tp, player_id](int32_t) {
+        IterateLockFree(rollout_tp, player_id);
     });
-    current_node_ = GetBestChild(current_node_);
-    return current_node_->GetLastMove();
+    return CommitBestMove(start_stats);
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-void MCTS<State, Move, UCB1Policy>::SetOpponentMove(const Move& opponent_move) {
-    const auto& available_moves = current_node_->GetMoves();
-    auto itr = std::find(available_moves.cbegin(),
-                         available_moves.cend(),
-                         opponent_move);
-    if (itr != available_moves.end()) {
-        current_node_ = current_node_->MakeChild(opponent_move);
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::IterateLockFree(ThreadPool& rollout_tp, int8_t player_id) {
+    auto state = current_state_;
+    const auto selected_leaf = Expand(Select(state), state);
+    const auto rewards = Rollout(GetLeafState(selected_leaf, state), player_id, rollout_tp);
+    if (IsStopping()) {
+        AbandonPath(selected_leaf);
     }
     else {
-        const auto & children = current_node_->GetChildren();
-        auto child = std::find_if(children.begin(), 
-								children.end(),[&opponent_move](
-                                const auto& node) noexcept {
-            return node->GetLastMove() == opponent_move;
-        });
-        assert(child != children.end());
-        if (child != children.end()) {
-            current_node_ = *child;
+        BackPropagation(selected_leaf, rewards);
+    }
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::StartPonder(ThreadPool& rollout_tp) {
+    StopPonder();
+    cancelled_ = false;
+    pondering_ = true;
+    // The opponent is to move at the current node, but the subtree is kept
+    // for this engine's next search, so score the rollouts for its side.
+    const int8_t player_id = tree_[current_node_].GetPlayerID() == kPlayerID ? kOpponentID : kPlayerID;
+    ponder_thread_ = std::thread([this, &rollout_tp, player_id]() {
+        while (pondering_.load(std::memory_order_relaxed)) {
+            if (seeded_) {
+                SeedIteration();
+            }
+            if constexpr (stats_type::kConcurrent) {
+                IterateLockFree(rollout_tp, player_id);
+            }
+            else {
+                Iterate(rollout_tp, player_id);
+            }
         }
+    });
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::StopPonder() {
+    pondering_ = false;
+    if (ponder_thread_.joinable()) {
+        // Cut the running playout short; its partial result is not backed up.
+        ponder_aborted_ = true;
+        ponder_thread_.join();
+        ponder_aborted_ = false;
     }
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-typename MCTS<State, Move, UCB1Policy>::node_ptr_type MCTS<State, Move, UCB1Policy>::Select() const {
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+bool MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::IsPondering() const noexcept {
+    return pondering_.load(std::memory_order_relaxed);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+Move MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::RunPipelinedSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, const SearchBudget& budget, const progress_callback_type& progress) {
+    static_assert(stats_type::kConcurrent, "PipelineParallel needs a concurrent stats layout such as AtomicStats");
+    StopPonder();
+
+    struct Leaf {
+        NodeIndex node = kInvalidNodeIndex;
+        replay_state_type state;
+    };
+
+    struct Result {
+        NodeIndex node = kInvalidNodeIndex;
+        RewardStats rewards;
+    };
+
+    if (IsOverBudget()) {
+        EvictSubtrees();
+        ReleaseEvicted();
+    }
+    const auto start_stats = tree_.GetStats();
+    TimeManager time_manager(budget.iterations, budget.time, search_extension_, &cancelled_);
+    const auto selectors = static_cast<int32_t>((std::max)(select_tp.GetThreadCount(), size_t(1)));
+    const auto rollout_workers = static_cast<int32_t>((std::max)(rollout_tp.GetThreadCount(), size_t(1)));
+    const auto player_id = tree_[current_node_].GetPlayerID();
+
+    BoundedQueue<Leaf> leaves(pipeline_capacity_);
+    BoundedQueue<Result> results(pipeline_capacity_);
+    std::atomic<int32_t> running_selectors(selectors);
+    std::atomic<int32_t> running_rollout_workers(rollout_workers);
+    std::atomic<size_t> select_stalls(0);
+    std::atomic<size_t> rollout_stalls(0);
+
+    auto select_futures = mcts::ParallelFor(select_tp, 0, selectors, 1, [&](int32_t) {
+        int32_t i = 0;
+        while (time_manager.Next(i)) {
+            Leaf leaf;
+            leaf.state = current_state_;
+            leaf.node = Expand(Select(leaf.state), leaf.state);
+            if (!leaves.TryEnqueue(std::move(leaf))) {
+                select_stalls.fetch_add(1, std::memory_order_relaxed);
+                while (!leaves.TryEnqueue(std::move(leaf))) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        running_selectors.fetch_sub(1, std::memory_order_release);
+    });
+
+    auto rollout_futures = mcts::ParallelFor(rollout_tp, 0, rollout_workers, 1, [&, player_id](int32_t) {
+        Leaf leaf;
+        for (;;) {
+            if (!leaves.TryDequeue(leaf)) {
+                if (running_selectors.load(std::memory_order_acquire) == 0 && leaves.GetSize() == 0) {
+                    break;
+                }
+                rollout_stalls.fetch_add(1, std::memory_order_relaxed);
+                std::this_thread::yield();
+                continue;
+            }
+            const auto& leaf_state = GetLeafState(leaf.node, leaf.state);
+            Result result;
+            result.node = leaf.node;
+            for (int32_t i = 0; i < rollout_limit_; ++i) {
+                result.rewards.Add(Playout(leaf_state, player_id));
+            }
+            while (!results.TryEnqueue(std::move(result))) {
+                std::this_thread::yield();
+            }
+        }
+        running_rollout_workers.fetch_sub(1, std::memory_order_release);
+    });
+
+    PipelineStats stats;
+    stats.leaf_capacity = leaves.GetCapacity();
+    stats.result_capacity = results.GetCapacity();
+    size_t total_leaf_depth = 0;
+    size_t total_result_depth = 0;
+    int32_t backpropagated = 0;
+    for (;;) {
+        const auto leaf_depth = leaves.GetSize();
+        const auto result_depth = results.GetSize();
+        Result result;
+        size_t batch = 0;
+        while (batch < kBackPropBatchSize && results.TryDequeue(result)) {
+            if (cancelled_.load(std::memory_order_relaxed)) {
+                AbandonPath(result.node);
+            }
+            else {
+                BackPropagation(result.node, result.rewards);
+            }
+            ++batch;
+            if (++backpropagated % kSearchCheckInterval == 0) {
+                CheckProgress(time_manager);
+            }
+            if (progress && time_manager.IsProgressDue(budget.progress_interval)) {
+                ReportProgress(time_manager, start_stats.nodes, progress);
+            }
+        }
+        if (batch == 0) {
+            if (running_rollout_workers.load(std::memory_order_acquire) == 0 && results.GetSize() == 0) {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        ++stats.batches;
+        total_leaf_depth += leaf_depth;
+        total_result_depth += result_depth;
+        stats.max_leaf_depth = (std::max)(stats.max_leaf_depth, leaf_depth);
+        stats.max_result_depth = (std::max)(stats.max_result_depth, result_depth);
+    }
+    for (auto& future : select_futures) {
+        future.get();
+    }
+    for (auto& future : rollout_futures) {
+        future.get();
+    }
+
+    if (stats.batches != 0) {
+        stats.average_leaf_depth = static_cast<double>(total_leaf_depth) / static_cast<double>(stats.batches);
+        stats.average_result_depth = static_cast<double>(total_result_depth) / static_cast<double>(stats.batches);
+    }
+    stats.select_stalls = select_stalls.load(std::memory_order_relaxed);
+    stats.rollout_stalls = rollout_stalls.load(std::memory_order_relaxed);
+    pipeline_stats_ = stats;
+    FinishSearch(time_manager);
+    return CommitBestMove(start_stats);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+Move MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::CommitBestMove(const AllocationStats& start_stats) {
+    search_allocation_stats_ = tree_.GetStats() - start_stats;
+    return PlayBestMove();
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+Move MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::PlayBestMove() {
+    const auto best = GetBestChild(current_node_);
+    if (best == kInvalidNodeIndex) {
+        throw std::logic_error("Search stopped before any move was tried");
+    }
+    Advance(best);
+    const auto& best_move = tree_[current_node_].GetLastMove();
+    if constexpr (!node_type::kStoresState) {
+        current_state_.ApplyMove(best_move);
+    }
+    return best_move;
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::SetOpponentMove(const Move& opponent_move) {
+    StopPonder();
+    const auto& node = tree_[current_node_];
+    for (auto child : tree_.GetChildren(current_node_)) {
+        if (tree_[child].GetLastMove() == opponent_move) {
+            Advance(child);
+            if constexpr (!node_type::kStoresState) {
+                current_state_.ApplyMove(opponent_move);
+            }
+            return;
+        }
+    }
+    assert(node.HasPassibleMoves());
+    tree_[current_node_].EraseMove(opponent_move);
+    Advance(MakeChild(current_node_, opponent_move, current_state_));
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+NodeIndex MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::Select(replay_state_type& state) {
     auto selected_node = current_node_;
-    while (!selected_node->HasPassibleMoves() && selected_node->IsLeaf()) {
+    if constexpr (stats_type::kConcurrent) {
+        stats_.AddVirtualLoss(tree_, selected_node, rollout_limit_);
+    }
+    while (!tree_[selected_node].HasPassibleMoves() && tree_[selected_node].HasChildren()) {
         selected_node = GetBestUCBChild(selected_node);
+        if constexpr (stats_type::kConcurrent) {
+            stats_.AddVirtualLoss(tree_, selected_node, rollout_limit_);
+        }
+        if constexpr (!node_type::kStoresState) {
+            state.ApplyMove(tree_[selected_node].GetLastMove());
+        }
     }
     return selected_node;
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-typename MCTS<State, Move, UCB1Policy>::node_ptr_type MCTS<State, Move, UCB1Policy>::Expand(node_ptr_type& parent) {
-    if (parent->HasPassibleMoves()) {
-        const auto& available_moves = parent->GetMoves();
-		auto itr = std::next(std::begin(available_moves), RNG::Get()(0, static_cast<int32_t>(available_moves.size() - 1)));
-		return parent->MakeChild(*itr);
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+NodeIndex MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::Expand(NodeIndex parent, replay_state_type& state) {
+    auto& node = tree_[parent];
+    // Another thread expanding this node makes it the leaf of this iteration.
+    if (node.HasPassibleMoves() && !IsOverBudget() && node.TryLockExpansion()) {
+        auto child = kInvalidNodeIndex;
+        if (node.HasPassibleMoves()) {
+            child = MakeChild(parent, TakeUntriedMove(parent, state), state);
+        }
+        node.UnlockExpansion();
+        if (child != kInvalidNodeIndex) {
+            if constexpr (stats_type::kConcurrent) {
+                stats_.AddVirtualLoss(tree_, child, rollout_limit_);
+            }
+            return child;
+        }
     }
-    if (parent->IsLeaf()) {
-	    const auto& children = parent->GetChildren();
-	    auto idx = RNG::Get()(static_cast<size_t>(0), children.size() - 1);
-	    return children[idx];
+    const auto children_size = node.GetChildrenSize();
+    if (children_size != 0) {
+	    auto idx = RNG::Get()(static_cast<uint32_t>(0), children_size - 1);
+	    const auto child = tree_.GetChild(node.GetFirstChild(), idx);
+        if constexpr (!node_type::kStoresState) {
+            state.ApplyMove(tree_[child].GetLastMove());
+        }
+        if constexpr (stats_type::kConcurrent) {
+            stats_.AddVirtualLoss(tree_, child, rollout_limit_);
+        }
+	    return child;
     }
     return parent;
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-double MCTS<State, Move, UCB1Policy>::Rollout(const node_ptr_type& leaf, ThreadPool& rollout_tp) {
-    std::atomic<double> total_score = 0.0;
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+NodeIndex MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::MakeChild(NodeIndex parent, const Move& move, replay_state_type& state) {
+    auto& node = tree_[parent];
+    if constexpr (node_type::kStoresState) {
+        State next_state(node.GetState());
+        next_state.ApplyMove(move);
+        const auto child = node.MakeChild(parent, move, next_state, tree_);
+        stats_.Attach(tree_, child, next_state);
+        return child;
+    }
+    else {
+        state.ApplyMove(move);
+        const auto child = node.MakeChild(parent, move, state, tree_);
+        stats_.Attach(tree_, child, state);
+        return child;
+    }
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+Move MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::TakeUntriedMove(NodeIndex parent, const replay_state_type& state) {
+    auto& node = tree_[parent];
+    if constexpr (node_type::kStoresState) {
+        return node.TakeUntriedMove();
+    }
+    else {
+        const auto children = tree_.GetChildren(parent);
+        auto skip = RNG::Get()(static_cast<uint32_t>(0), node.GetMovesSize() - 1);
+        for (const auto& move : state.GetLegalMoves()) {
+            const auto tried = std::any_of(children.begin(), children.end(), [this, &move](NodeIndex child) {
+                return tree_[child].GetLastMove() == move;
+            });
+            if (!tried && skip-- == 0) {
+                node.EraseMove(move);
+                return move;
+            }
+        }
+        throw std::logic_error("Untried move not found");
+    }
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+const State& MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::GetLeafState(NodeIndex leaf, const replay_state_type& state) const {
+    if constexpr (node_type::kStoresState) {
+        return tree_[leaf].GetState();
+    }
+    else {
+        return state;
+    }
+}
 
-#define FETCH_ADD_DOUBLE(atomic_var, inc) \
-    auto current = atomic_var.load(); \
-    while (!atomic_var.compare_exchange_weak(current, current + inc)){}
 
-    mcts::ParallelFor(rollout_tp, rollout_limit_, [&total_score, leaf, this](auto) {
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+RewardStats MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::Rollout(const State& leaf_state, int8_t player_id, ThreadPool& rollout_tp) {
+    std::vector<double> results(rollout_limit_);
+    // SeedIteration() already counted the iteration.
+    const auto stream = seed_iteration_ - 1;
+    mcts::ParallelFor(rollout_tp, rollout_limit_, [this, &results, &leaf_state, player_id, stream](auto i) {
     //for (auto i = 0; i < rollout_limit_; ++i) {
-        auto state = leaf->GetState();
-        while (!state.IsTerminal()) {
-            state.ApplyMove(state.GetRandomMove());
-        }
-        double result = state.Evaluate();
-        result = 0.5 * (result + 1) * (current_node_->GetPlayerID() == kPlayerID)
-            + 0.5 * (1 - result) * (current_node_->GetPlayerID() == kOpponentID);
-        FETCH_ADD_DOUBLE(total_score, result)
+        if (seeded_) {
+            RNG::Get().Seed(RNG::GetStreamSeed(RNG::GetStreamSeed(seed_, stream), i + 1));
+        }
+        results[i] = Playout(leaf_state, player_id);
     //}
     });
-    return total_score;
+    RewardStats rewards;
+    for (const auto result : results) {
+        rewards.Add(result);
+    }
+    return rewards;
 }
 
-template <typename State, typename Move, typename UCB1Policy>
-void MCTS<State, Move, UCB1Policy>::BackPropagation(const node_ptr_type& leaf, double score) {
-    leaf->Update(score, rollout_limit_);
-    auto parent = leaf->GetParent();
-    if (!parent) {
-        return;
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::Rollout(const std::vector<const State*>& leaf_states, int8_t player_id, std::vector<RewardStats>& rewards, ThreadPool& rollout_tp) {
+    const auto rollouts = static_cast<int32_t>(leaf_states.size()) * rollout_limit_;
+    std::vector<double> results(rollouts);
+    mcts::ParallelFor(rollout_tp, rollouts, [this, &results, &leaf_states, player_id](auto i) {
+        results[i] = Playout(*leaf_states[i / rollout_limit_], player_id);
+    });
+    for (int32_t i = 0; i < rollouts; ++i) {
+        rewards[i / rollout_limit_].Add(results[i]);
     }
+}
 
-    parent->Update(score, rollout_limit_);
-    while (true) {
-        parent = parent->GetParent();
-        if (parent != nullptr) {
-            parent->Update(score, rollout_limit_);
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+double MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::Playout(const State& leaf_state, int8_t player_id) const {
+    auto state = leaf_state;
+    while (!state.IsTerminal() && !IsStopping()) {
+        state.ApplyMove(state.GetRandomMove());
+    }
+    double result = state.Evaluate();
+    return 0.5 * (result + 1) * (player_id == kPlayerID)
+        + 0.5 * (1 - result) * (player_id == kOpponentID);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+bool MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::IsStopping() const noexcept {
+    return cancelled_.load(std::memory_order_relaxed)
+        || ponder_aborted_.load(std::memory_order_relaxed);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::BackPropagation(NodeIndex leaf, const RewardStats& rewards) {
+    for (auto node = leaf; node != kInvalidNodeIndex; node = tree_[node].GetParent()) {
+        stats_.Update(tree_, node, rewards);
+        if constexpr (stats_type::kConcurrent) {
+            stats_.RemoveVirtualLoss(tree_, node, rollout_limit_);
         }
-        else {
+    }
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::AbandonPath(NodeIndex leaf) {
+    if constexpr (stats_type::kConcurrent) {
+        for (auto node = leaf; node != kInvalidNodeIndex; node = tree_[node].GetParent()) {
+            stats_.RemoveVirtualLoss(tree_, node, rollout_limit_);
+        }
+    }
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+bool MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::IsOverBudget() const noexcept {
+    return tree_.GetNodeCount() >= node_budget_
+        || tree_.GetMemoryUsage() > byte_budget_ - (std::min)(byte_budget_, tree_type::kChunkBytes);
+}
+
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::EvictSubtrees() {
+    // (visits, -depth, node)
+    std::vector<std::tuple<int64_t, int32_t, NodeIndex>> candidates;
+    std::vector<std::pair<NodeIndex, int32_t>> stack{ { current_node_, 0 } };
+    while (!stack.empty()) {
+        const auto [index, depth] = stack.back();
+        stack.pop_back();
+        for (auto child : tree_.GetChildren(index)) {
+            if (tree_[child].HasChildren()) {
+                candidates.emplace_back(stats_.GetVisits(tree_, child), -(depth + 1), child);
+                stack.emplace_back(child, depth + 1);
+            }
+        }
+    }
+    // Small, deep subtrees go first. Shared statistics can give a node more
+    // visits than its ancestors, so a candidate whose ancestor was already
+    // dropped is skipped rather than handing out its range twice.
+    std::sort(candidates.begin(), candidates.end());
+
+    const auto is_attached = [this](NodeIndex index) {
+        while (index != current_node_) {
+            const auto parent = tree_[index].GetParent();
+            const auto children = tree_.GetChildren(parent);
+            if (std::find(children.begin(), children.end(), index) == children.end()) {
+                return false;
+            }
+            index = parent;
+        }
+        return true;
+    };
+
+    auto target = node_budget_ - node_budget_ / 4;
+    auto live_nodes = tree_.GetNodeCount();
+    const auto live_bytes = live_nodes * (tree_type::kChunkBytes / tree_type::kChunkSize) + tree_.GetHeapBytes();
+    const auto byte_target = byte_budget_ - byte_budget_ / 4;
+    if (live_bytes > byte_target) {
+        target = (std::min)(target, static_cast<size_t>(static_cast<double>(live_nodes) * byte_target / live_bytes));
+    }
+    for (const auto& candidate : candidates) {
+        if (live_nodes <= target) {
             break;
         }
+        auto& node = tree_[std::get<2>(candidate)];
+        if (!node.HasChildren() || !is_attached(std::get<2>(candidate))) {
+            continue;
+        }
+        std::vector<NodeIndex> pending{ std::get<2>(candidate) };
+        size_t dropped = 0;
+        while (!pending.empty()) {
+            const auto descendant = pending.back();
+            pending.pop_back();
+            for (auto child : tree_.GetChildren(descendant)) {
+                pending.push_back(child);
+                ++dropped;
+            }
+        }
+        evicted_ranges_.emplace_back(node.GetFirstChild(), node.GetChildrenSize());
+        const auto heap_bytes = node.GetHeapBytes();
+        std::lock_guard guard{ structure_mutex_ };
+        tree_.ReleaseEmptySlots(std::get<2>(candidate));
+        node.DropChildren();
+        tree_.UpdateHeapBytes(heap_bytes, node.GetHeapBytes());
+        live_nodes = dropped < live_nodes ? live_nodes - dropped : 0;
     }
 }
 
+template <typename State, typename Move, typename UCB1Policy, typename NodeAllocator, template <typename, typename> class NodeState, template <typename> class StatsLayout, typename ParallelPolicy>
+void MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, ParallelPolicy>::ReleaseEvicted() noexcept {
+    for (const auto& range : evicted_ranges_) {
+        for (auto child : tree_.GetChildRange(range.first, range.second)) {
+            tree_.DestroySubtree(child);
+        }
+    }
+    evicted_ranges_.clear();
 }
 
+}
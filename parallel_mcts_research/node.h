@@ -2,11 +2,15 @@
 
 #pragma once
 
-#include <memory>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <utility>
 
 #include "tweakme.h"
+#include "nodetree.h"
+#include "untriedmoves.h"
 
 namespace mcts {
 
@@ -15,80 +19,237 @@ enum {
     kOpponentID = 2,
 };
 
-template <typename State, typename Move, typename UCB1Policy>
-class Node;
+template <typename T, typename = void>
+struct HasHeapBytes : std::false_type {
+};
 
-template <typename State, typename Move, typename UCB1Policy>
-using NodePtr = std::shared_ptr<Node<State, Move, UCB1Policy>>;
+template <typename T>
+struct HasHeapBytes<T, std::void_t<decltype(std::declval<const T&>().GetHeapBytes())>> : std::true_type {
+};
 
-template <typename State, typename Move, typename UCB1Policy>
-using WeakPtr = std::weak_ptr<Node<State, Move, UCB1Policy>>;
+// Heap bytes owned by value: what its GetHeapBytes() reports, 0 for types
+// without one.
+template <typename T>
+size_t GetHeapBytes(const T& value) noexcept {
+    if constexpr (HasHeapBytes<T>::value) {
+        return value.GetHeapBytes();
+    }
+    else {
+        return 0;
+    }
+}
 
-template <typename State, typename Move, typename UCB1Policy>
-class Node 
-	: public std::enable_shared_from_this<Node<State, Move, UCB1Policy>> {
+// Keeps a full copy of the board and the untried moves in every node. The
+// untried-move container is chosen per game by UntriedMovesTraits.
+template <typename State, typename Move>
+class StoredNodeState {
 public:
-    using self_type = Node<State, Move, UCB1Policy>;
-    using ptr_type = NodePtr<State, Move, UCB1Policy>;
-    using parent_ptr_type = WeakPtr<State, Move, UCB1Policy>;
+    static constexpr bool kStoresState = true;
+
+    using moves_type = typename UntriedMovesTraits<Move>::type;
+
+    explicit StoredNodeState(const State& state)
+        : possible_moves_(state)
+        , board_states_(state) {
+    }
+
+    [[nodiscard]] bool HasPassibleMoves() const noexcept {
+        return !possible_moves_.IsEmpty();
+    }
+
+    [[nodiscard]] uint32_t GetMovesSize() const noexcept {
+        return possible_moves_.GetSize();
+    }
+
+    void EraseMove(const Move& move) {
+        possible_moves_.Erase(move);
+    }
+
+    Move TakeUntriedMove() {
+        return possible_moves_.TakeRandom();
+    }
+
+    const State& GetState() const noexcept {
+        return board_states_;
+    }
+
+    [[nodiscard]] size_t GetHeapBytes() const noexcept {
+        return mcts::GetHeapBytes(possible_moves_) + mcts::GetHeapBytes(board_states_);
+    }
+
+    void SetState(const State& state, uint32_t) {
+        board_states_ = state;
+    }
+
+    // Makes every legal move untried again after the children were dropped.
+    void RestoreMoves(uint32_t) {
+        possible_moves_ = moves_type(board_states_);
+    }
+
+private:
+    moves_type possible_moves_;
+    State board_states_;
+};
+
+// Keeps only the number of untried moves. The board is rebuilt by replaying
+// the moves from the current node, and the untried moves are the legal moves
+// of that board minus the moves of the existing children.
+template <typename State, typename Move>
+class ReplayNodeState {
+public:
+    static constexpr bool kStoresState = false;
+
+    explicit ReplayNodeState(const State& state)
+        : untried_size_(static_cast<uint32_t>(state.GetLegalMoves().size())) {
+    }
+
+    [[nodiscard]] bool HasPassibleMoves() const noexcept {
+        return untried_size_ != 0;
+    }
+
+    [[nodiscard]] uint32_t GetMovesSize() const noexcept {
+        return untried_size_;
+    }
 
-    explicit Node(State state = State(),
+    void EraseMove(const Move&) noexcept {
+        --untried_size_;
+    }
+
+    [[nodiscard]] size_t GetHeapBytes() const noexcept {
+        return 0;
+    }
+
+    // A node with children never gets more untried moves than it had, the
+    // last block of its children may be cut to them (see NodeTree).
+    void SetState(const State& state, uint32_t children_size) {
+        const auto legal_size = static_cast<uint32_t>(state.GetLegalMoves().size());
+        const auto untried_size = legal_size > children_size ? legal_size - children_size : 0;
+        untried_size_ = children_size != 0 ? (std::min)(untried_size_, untried_size) : untried_size;
+    }
+
+    void RestoreMoves(uint32_t children_size) noexcept {
+        untried_size_ += children_size;
+    }
+
+private:
+    uint32_t untried_size_;
+};
+
+template
+<
+    typename State,
+    typename Move,
+    typename NodeStats,
+    typename NodeState = StoredNodeState<State, Move>
+>
+class Node {
+public:
+    using state_type = State;
+    using move_type = Move;
+
+    static constexpr bool kStoresState = NodeState::kStoresState;
+
+    explicit Node(const State& state = State(),
                   Move move = Move(),
-                  ptr_type parent = nullptr)
-        : player_id_(state.GetPlayerID())        
+                  NodeIndex parent = kInvalidNodeIndex)
+        : player_id_(state.GetPlayerID())
+        , flags_(0)
         , move_(move)
         , parent_(parent)
-        , possible_moves_(state.GetLegalMoves())
-		, board_states_(state) {
+        , first_child_(kInvalidNodeIndex)
+        , children_size_(0)
+        , node_state_(state)
+        , next_block_(kInvalidNodeIndex) {
+        UpdateHasMoves();
     }
 
     Node(const Node&) = delete;
     Node& operator=(const Node&) = delete;
 
-    ptr_type MakeChild(const Move &next_move) {
-        State next_state(board_states_);
-        next_state.ApplyMove(next_move);
-        auto parent = this->shared_from_this();
-        auto new_node = std::make_shared<self_type>(
-                    next_state,
-                    next_move,
-                    parent);
-        children_.push_back(new_node);
-        possible_moves_.erase(next_move);
-        return new_node;
+    // Only one thread at a time may take untried moves and make children.
+    // Readers never wait: the child count is published after the child is
+    // constructed, and HasPassibleMoves() reads a flag kept next to it.
+    [[nodiscard]] bool TryLockExpansion() noexcept {
+        return (flags_.fetch_or(kExpanding, std::memory_order_acquire) & kExpanding) == 0;
+    }
+
+    void UnlockExpansion() noexcept {
+        flags_.fetch_and(static_cast<uint8_t>(~kExpanding), std::memory_order_release);
+    }
+
+    // Children are constructed into blocks the tree reserves as they fill
+    // up. next_move must already be taken out of the untried moves,
+    // next_state is the board after it.
+    template <typename Tree>
+    NodeIndex MakeChild(NodeIndex self, const Move &next_move, const State &next_state, Tree &tree) {
+        const auto size = children_size_.load(std::memory_order_relaxed);
+        const auto child = tree.ReserveChild(first_child_.load(std::memory_order_relaxed),
+                                             size,
+                                             node_state_.GetMovesSize() + 1);
+        if (size == 0) {
+            first_child_.store(child, std::memory_order_relaxed);
+        }
+        tree.Construct(child, next_state, next_move, self);
+        children_size_.store(size + 1, std::memory_order_release);
+        return child;
+    }
+
+    // Forgets the children, whose range now belongs to the caller, and makes
+    // their moves untried again. The node keeps the statistics it collected
+    // through them.
+    void DropChildren() {
+        node_state_.RestoreMoves(GetChildrenSize());
+        first_child_.store(kInvalidNodeIndex, std::memory_order_relaxed);
+        children_size_.store(0, std::memory_order_release);
+        UpdateHasMoves();
+    }
+
+    void EraseMove(const Move& move) {
+        node_state_.EraseMove(move);
+        UpdateHasMoves();
+    }
+
+    Move TakeUntriedMove() {
+        auto move = node_state_.TakeUntriedMove();
+        UpdateHasMoves();
+        return move;
     }
 
-    [[nodiscard]] bool IsLeaf() const noexcept {
-        return !children_.empty();
+    [[nodiscard]] bool HasChildren() const noexcept {
+        return GetChildrenSize() != 0;
     }
 
     [[nodiscard]] bool HasPassibleMoves() const noexcept {
-		return !possible_moves_.empty();
+        return (flags_.load(std::memory_order_acquire) & kHasMoves) != 0;
 	}
 
-	void Update(double score, int32_t visits) noexcept {
-		ucb1_policy_.Update(score, visits);
-	}    
+    [[nodiscard]] uint32_t GetMovesSize() const noexcept {
+        return node_state_.GetMovesSize();
+    }
 
-    [[nodiscard]] double GetScore() const noexcept {
-		return ucb1_policy_.GetScore();
+    // Statistics kept inside the node; NoNodeStats when the layout stores
+    // them in the tree's columns.
+    NodeStats& GetStats() noexcept {
+        return stats_;
     }
 
-    [[nodiscard]] int64_t GetVisits() const noexcept {
-        return ucb1_policy_.GetVisits();
+    const NodeStats& GetStats() const noexcept {
+        return stats_;
     }
 
     const State & GetState() const {
-        return board_states_;
+        return node_state_.GetState();
     }
 
-    void SetState(const State& state) {
-        board_states_ = state;
+    // Heap memory owned by the state and untried moves kept in the node.
+    [[nodiscard]] size_t GetHeapBytes() const noexcept {
+        return node_state_.GetHeapBytes();
     }
 
-	const HashSet<Move>& GetMoves() const noexcept {
-		return possible_moves_;
-	}
+    void SetState(const State& state) {
+        node_state_.SetState(state, GetChildrenSize());
+        UpdateHasMoves();
+    }
 
     const Move & GetLastMove() const noexcept {
         return move_;
@@ -98,34 +259,56 @@ public:
         return player_id_;
     }
 
-    const std::vector<ptr_type>& GetChildren() const noexcept {
-        return children_;
+    [[nodiscard]] NodeIndex GetParent() const noexcept {
+        return parent_;
     }
 
-    ptr_type GetParent() const {
-        return parent_.lock();
+    void SetParent(NodeIndex parent) noexcept {
+        parent_ = parent;
     }
 
-    [[nodiscard]] size_t GetChildrenSize() const noexcept {
-        return children_.size();
+    // Read GetChildrenSize() first when other threads may be expanding.
+    [[nodiscard]] NodeIndex GetFirstChild() const noexcept {
+        return first_child_.load(std::memory_order_relaxed);
     }
 
-    [[nodiscard]] double GetUCB() const noexcept {
-        return ucb1_policy_(GetParent()->GetVisits());
+    [[nodiscard]] uint32_t GetChildrenSize() const noexcept {
+        return children_size_.load(std::memory_order_acquire);
     }
 
-    [[nodiscard]] double GetWinRate() const {
-		return GetScore() / static_cast<double>(GetVisits());
-	}
+    // Link from the first node of a block of siblings to the next block.
+    [[nodiscard]] NodeIndex GetNextBlock() const noexcept {
+        return next_block_.load(std::memory_order_relaxed);
+    }
+
+    void SetNextBlock(NodeIndex block) noexcept {
+        next_block_.store(block, std::memory_order_relaxed);
+    }
 
 private:
-    int8_t player_id_;       
+    enum : uint8_t {
+        kHasMoves = 1,
+        kExpanding = 2,
+    };
+
+    void UpdateHasMoves() noexcept {
+        if (node_state_.HasPassibleMoves()) {
+            flags_.fetch_or(kHasMoves, std::memory_order_release);
+        }
+        else {
+            flags_.fetch_and(static_cast<uint8_t>(~kHasMoves), std::memory_order_release);
+        }
+    }
+
+    int8_t player_id_;
+    std::atomic<uint8_t> flags_;
     Move move_;
-    parent_ptr_type parent_;
-	UCB1Policy ucb1_policy_;
-    std::vector<ptr_type> children_;
-    HashSet<Move> possible_moves_;
-	State board_states_;
+    NodeIndex parent_;
+    std::atomic<NodeIndex> first_child_;
+    std::atomic<uint32_t> children_size_;
+    NodeStats stats_;
+    NodeState node_state_;
+    std::atomic<NodeIndex> next_block_;
 };
 
 }
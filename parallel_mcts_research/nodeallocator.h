@@ -0,0 +1,355 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "tweakme.h"
+
+namespace mcts {
+
+struct AllocationStats {
+    AllocationStats() noexcept
+        : bytes(0)
+        , nodes(0) {
+    }
+
+    AllocationStats(size_t bytes, size_t nodes) noexcept
+        : bytes(bytes)
+        , nodes(nodes) {
+    }
+
+    size_t bytes;
+    size_t nodes;
+};
+
+inline AllocationStats operator-(const AllocationStats& lhs, const AllocationStats& rhs) noexcept {
+    return AllocationStats(lhs.bytes - rhs.bytes, lhs.nodes - rhs.nodes);
+}
+
+// Thread-local cache of entries attached to owner objects. A thread keeps
+// entries for the last few owners it worked for; see PerThread for state
+// that must survive eviction.
+template <typename T, size_t N = 4>
+class ThreadSlot {
+public:
+    static uint64_t NextOwnerID() noexcept {
+        static std::atomic<uint64_t> next_id{ 1 };
+        return next_id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Returns the calling thread's entry for owner_id; a new entry is value
+    // initialized.
+    static T& Get(uint64_t owner_id) noexcept {
+        static thread_local Entry entries[N];
+        static thread_local size_t next_victim = 0;
+
+        for (auto& entry : entries) {
+            if (entry.owner_id == owner_id) {
+                return entry.value;
+            }
+        }
+        auto& entry = entries[next_victim++ % N];
+        entry.owner_id = owner_id;
+        entry.value = T();
+        return entry.value;
+    }
+
+private:
+    struct Entry {
+        uint64_t owner_id = 0;
+        T value{};
+    };
+};
+
+// Per-thread state kept by its owner (an allocator or a node tree), one entry
+// per thread that used it. A thread finds its entry through ThreadSlot and,
+// when a dispatcher serving many engines has evicted it there, looks it up
+// again here, so it goes on with the entry as it left it instead of starting
+// a new one.
+template <typename T>
+class PerThread {
+public:
+    PerThread() noexcept
+        : id_(ThreadSlot<T*>::NextOwnerID()) {
+    }
+
+    PerThread(const PerThread&) = delete;
+    PerThread& operator=(const PerThread&) = delete;
+
+    // Returns the calling thread's entry; a new entry is value initialized.
+    T& Get() {
+        auto& entry = ThreadSlot<T*>::Get(id_.load(std::memory_order_relaxed));
+        if (entry == nullptr) {
+            entry = &Find();
+        }
+        return *entry;
+    }
+
+    // Drops every entry. No thread may be inside Get() while this runs.
+    void Clear() noexcept {
+        std::lock_guard guard{ mutex_ };
+        entries_.clear();
+        id_.store(ThreadSlot<T*>::NextOwnerID(), std::memory_order_relaxed);
+    }
+
+private:
+    T& Find() {
+        const auto thread_id = std::this_thread::get_id();
+        std::lock_guard guard{ mutex_ };
+        for (auto& entry : entries_) {
+            if (entry.first == thread_id) {
+                return *entry.second;
+            }
+        }
+        entries_.emplace_back(thread_id, std::make_unique<T>());
+        return *entries_.back().second;
+    }
+
+    std::atomic<uint64_t> id_;
+    FastMutex mutex_;
+    std::vector<std::pair<std::thread::id, std::unique_ptr<T>>> entries_;
+};
+
+// Plain heap allocation, one block per request.
+class DefaultNodeAllocator {
+public:
+    DefaultNodeAllocator() noexcept
+        : bytes_(0) {
+    }
+
+    DefaultNodeAllocator(const DefaultNodeAllocator&) = delete;
+    DefaultNodeAllocator& operator=(const DefaultNodeAllocator&) = delete;
+
+    ~DefaultNodeAllocator() {
+        Release();
+    }
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        bytes_.fetch_add(size, std::memory_order_relaxed);
+        auto p = ::operator new(size, std::align_val_t(alignment));
+        std::lock_guard guard{ mutex_ };
+        blocks_.emplace_back(p, alignment);
+        return p;
+    }
+
+    void Release() noexcept {
+        std::lock_guard guard{ mutex_ };
+        for (const auto& block : blocks_) {
+            ::operator delete(block.first, std::align_val_t(block.second));
+        }
+        blocks_.clear();
+    }
+
+    [[nodiscard]] AllocationStats GetStats() const noexcept {
+        return AllocationStats(bytes_.load(std::memory_order_relaxed), 0);
+    }
+
+private:
+    std::atomic<size_t> bytes_;
+    FastMutex mutex_;
+    std::vector<std::pair<void*, size_t>> blocks_;
+};
+
+// Bump allocator with one slab per search thread. Memory handed out is never
+// returned piecewise; the owner frees every slab at once with Release() after
+// the whole tree has been destroyed.
+class ArenaNodeAllocator {
+public:
+    static constexpr size_t kSlabSize = 1024 * 1024;
+
+    ArenaNodeAllocator() noexcept
+        : bytes_(0) {
+    }
+
+    ArenaNodeAllocator(const ArenaNodeAllocator&) = delete;
+    ArenaNodeAllocator& operator=(const ArenaNodeAllocator&) = delete;
+
+    ~ArenaNodeAllocator() {
+        Release();
+    }
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        bytes_.fetch_add(size, std::memory_order_relaxed);
+
+        if (size > kSlabSize / 4) {
+            return AlignUp(NewBlock(size + alignment), alignment);
+        }
+
+        auto& slab = slabs_.Get();
+        auto cursor = AlignUp(slab.cursor, alignment);
+        if (slab.cursor == nullptr || cursor + size > slab.end) {
+            slab.cursor = NewBlock(kSlabSize);
+            slab.end = slab.cursor + kSlabSize;
+            cursor = AlignUp(slab.cursor, alignment);
+        }
+        slab.cursor = cursor + size;
+        return cursor;
+    }
+
+    // Frees every slab. Nothing allocated from this arena may be used again.
+    void Release() noexcept {
+        slabs_.Clear();
+        std::lock_guard guard{ mutex_ };
+        blocks_.clear();
+    }
+
+    [[nodiscard]] AllocationStats GetStats() const noexcept {
+        return AllocationStats(bytes_.load(std::memory_order_relaxed), 0);
+    }
+
+private:
+    struct ThreadSlab {
+        char* cursor = nullptr;
+        char* end = nullptr;
+    };
+
+    static char* AlignUp(char* p, size_t alignment) noexcept {
+        const auto value = reinterpret_cast<uintptr_t>(p);
+        return reinterpret_cast<char*>((value + alignment - 1) & ~(alignment - 1));
+    }
+
+    char* NewBlock(size_t size) {
+        std::unique_ptr<char[]> block(new char[size]);
+        auto p = block.get();
+        std::lock_guard guard{ mutex_ };
+        blocks_.push_back(std::move(block));
+        return p;
+    }
+
+    PerThread<ThreadSlab> slabs_;
+    std::atomic<size_t> bytes_;
+    FastMutex mutex_;
+    std::vector<std::unique_ptr<char[]>> blocks_;
+};
+
+// Carves node chunks out of one large virtual region backed by huge pages,
+// so a random walk down a big tree needs far fewer TLB entries. The region
+// comes from hugetlbfs (MAP_HUGETLB) when the system has a huge page pool,
+// otherwise from an anonymous mapping with MADV_HUGEPAGE. When neither is
+// available, or the region is full, chunks come from the heap.
+class HugePageNodeAllocator {
+public:
+    static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+    static constexpr size_t kRegionSize = size_t(1) << 30;
+
+    enum PageMode {
+        kNormalPages,
+        kTransparentHugePages,
+        kHugeTlbPages,
+    };
+
+    HugePageNodeAllocator() noexcept
+        : mode_(kNormalPages)
+        , tried_map_(false)
+        , mapping_(nullptr)
+        , region_(nullptr)
+        , mapped_size_(0)
+        , used_(0)
+        , bytes_(0) {
+    }
+
+    HugePageNodeAllocator(const HugePageNodeAllocator&) = delete;
+    HugePageNodeAllocator& operator=(const HugePageNodeAllocator&) = delete;
+
+    ~HugePageNodeAllocator() {
+        Release();
+    }
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        {
+            std::lock_guard guard{ mutex_ };
+            if (!tried_map_) {
+                tried_map_ = true;
+                Map();
+            }
+            if (region_ != nullptr) {
+                const auto offset = (used_ + alignment - 1) & ~(alignment - 1);
+                if (offset + size <= kRegionSize) {
+                    used_ = offset + size;
+                    bytes_.fetch_add(size, std::memory_order_relaxed);
+                    return region_ + offset;
+                }
+            }
+        }
+        return fallback_.Allocate(size, alignment);
+    }
+
+    void Release() noexcept {
+        std::lock_guard guard{ mutex_ };
+        Unmap();
+        fallback_.Release();
+    }
+
+    [[nodiscard]] PageMode GetPageMode() const noexcept {
+        std::lock_guard guard{ mutex_ };
+        return mode_;
+    }
+
+    [[nodiscard]] AllocationStats GetStats() const noexcept {
+        return AllocationStats(bytes_.load(std::memory_order_relaxed) + fallback_.GetStats().bytes, 0);
+    }
+
+private:
+    void Map() noexcept {
+#ifdef __linux__
+        auto p = ::mmap(nullptr, kRegionSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            region_ = static_cast<char*>(p);
+            mapped_size_ = kRegionSize;
+            mode_ = kHugeTlbPages;
+            return;
+        }
+        // Over-map by one huge page so the region can start on a huge page
+        // boundary, which transparent huge pages need.
+        p = ::mmap(nullptr, kRegionSize + kHugePageSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            return;
+        }
+        mapping_ = static_cast<char*>(p);
+        mapped_size_ = kRegionSize + kHugePageSize;
+        const auto value = reinterpret_cast<uintptr_t>(p);
+        region_ = reinterpret_cast<char*>((value + kHugePageSize - 1) & ~(kHugePageSize - 1));
+        mode_ = ::madvise(region_, kRegionSize, MADV_HUGEPAGE) == 0 ? kTransparentHugePages : kNormalPages;
+#endif
+    }
+
+    void Unmap() noexcept {
+#ifdef __linux__
+        if (region_ != nullptr) {
+            ::munmap(mapping_ != nullptr ? mapping_ : region_, mapped_size_);
+        }
+#endif
+        tried_map_ = false;
+        mapping_ = nullptr;
+        region_ = nullptr;
+        mapped_size_ = 0;
+        used_ = 0;
+    }
+
+    PageMode mode_;
+    bool tried_map_;
+    char* mapping_;
+    char* region_;
+    size_t mapped_size_;
+    size_t used_;
+    std::atomic<size_t> bytes_;
+    mutable FastMutex mutex_;
+    DefaultNodeAllocator fallback_;
+};
+
+}
@@ -0,0 +1,737 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+#include "nodetree.h"
+#include "transpositiontable.h"
+#include "parallelpolicy.h"
+#include "ucbpolicy.h"
+
+namespace mcts {
+
+// Node member used when the statistics are not stored in the node.
+struct NoNodeStats {
+};
+
+// Array of structs: every node owns a UCB1Policy object holding its
+// statistics. Scoring the children of a node touches one node per child.
+template <typename UCB1Policy>
+class PerNodeStats {
+public:
+    static constexpr uint32_t kColumns = 0;
+    static constexpr bool kConcurrent = false;
+
+    using node_stats_type = UCB1Policy;
+
+    template <typename Tree, typename State>
+    static void Attach(Tree&, NodeIndex, const State&) noexcept {
+    }
+
+    static void Purge() noexcept {
+    }
+
+    template <typename Tree>
+    static int64_t GetVisits(const Tree& tree, NodeIndex index) noexcept {
+        return tree[index].GetStats().GetVisits();
+    }
+
+    template <typename Tree>
+    static double GetScore(const Tree& tree, NodeIndex index) noexcept {
+        return tree[index].GetStats().GetScore();
+    }
+
+    // Squared deviations of the rewards, 0 if UCB1Policy does not keep them.
+    template <typename Tree>
+    static double GetDeviations(const Tree& tree, NodeIndex index) noexcept {
+        if constexpr (UCB1Policy::kTracksSquares) {
+            return tree[index].GetStats().GetDeviations();
+        }
+        else {
+            return 0;
+        }
+    }
+
+    template <typename Tree>
+    static void Update(Tree& tree, NodeIndex index, const RewardStats& rewards) noexcept {
+        tree[index].GetStats().Update(rewards);
+    }
+
+    // Virtual loss for batched selection under one lock. The pending visits
+    // count as wins in the statistics themselves until they are removed.
+    template <typename Tree>
+    static void AddVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        tree[index].GetStats().AddVirtualVisits(visits);
+    }
+
+    template <typename Tree>
+    static void RemoveVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        tree[index].GetStats().AddVirtualVisits(-visits);
+    }
+
+    // Returns the child among the size children from first on that
+    // GetBestUCBChild picks.
+    template <typename Tree>
+    static NodeIndex SelectChild(const Tree& tree, const VisitTables& tables, NodeIndex first, uint32_t size, int64_t parent_visits) noexcept {
+        const auto parent_term = UCB1Policy::GetParentTerm(tables, parent_visits);
+        const auto children = tree.GetChildRange(first, size);
+        auto itr = children.begin();
+        auto best = *itr;
+        auto best_ucb = tree[best].GetStats()(tables, parent_term);
+        for (++itr; itr != children.end(); ++itr) {
+            const auto child = *itr;
+            const auto ucb = tree[child].GetStats()(tables, parent_term);
+            if (best_ucb > ucb) {
+                best_ucb = ucb;
+                best = child;
+            }
+        }
+        return best;
+    }
+};
+
+// Struct of arrays: visits, scores and (for UCB1-Tuned) squared deviations
+// of the rewards are
+// stored as parallel columns next to the chunk holding the nodes. Siblings
+// occupy a few blocks of contiguous indices, so scoring the children of a
+// node is a linear scan over packed int64_t and double arrays per block.
+template <typename UCB1Policy>
+class PackedStats {
+public:
+    static constexpr uint32_t kVisitsColumn = 0;
+    static constexpr uint32_t kScoreColumn = 1;
+    static constexpr uint32_t kSquareColumn = 2;
+    static constexpr uint32_t kColumns = UCB1Policy::kTracksSquares ? 3 : 2;
+    static constexpr bool kConcurrent = false;
+
+    using node_stats_type = NoNodeStats;
+
+    template <typename Tree, typename State>
+    static void Attach(Tree&, NodeIndex, const State&) noexcept {
+    }
+
+    static void Purge() noexcept {
+    }
+
+    template <typename Tree>
+    static int64_t GetVisits(const Tree& tree, NodeIndex index) noexcept {
+        return *tree.template GetColumn<int64_t>(index, kVisitsColumn);
+    }
+
+    template <typename Tree>
+    static double GetScore(const Tree& tree, NodeIndex index) noexcept {
+        return *tree.template GetColumn<double>(index, kScoreColumn);
+    }
+
+    template <typename Tree>
+    static double GetDeviations(const Tree& tree, NodeIndex index) noexcept {
+        if constexpr (UCB1Policy::kTracksSquares) {
+            return *tree.template GetColumn<double>(index, kSquareColumn);
+        }
+        else {
+            return 0;
+        }
+    }
+
+    template <typename Tree>
+    static void Update(Tree& tree, NodeIndex index, const RewardStats& rewards) noexcept {
+        auto& visits_sum = *tree.template GetColumn<int64_t>(index, kVisitsColumn);
+        auto& score_sum = *tree.template GetColumn<double>(index, kScoreColumn);
+        if constexpr (UCB1Policy::kTracksSquares) {
+            auto& deviations = *tree.template GetColumn<double>(index, kSquareColumn);
+            UCB1Policy::Accumulate(score_sum, visits_sum, deviations, rewards);
+        }
+        else {
+            UCB1Policy::Accumulate(score_sum, visits_sum, rewards);
+        }
+    }
+
+    // As in PerNodeStats.
+    template <typename Tree>
+    static void AddVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        *tree.template GetColumn<int64_t>(index, kVisitsColumn) += visits;
+        *tree.template GetColumn<double>(index, kScoreColumn) += visits;
+    }
+
+    template <typename Tree>
+    static void RemoveVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        AddVirtualLoss(tree, index, -visits);
+    }
+
+    // Picks the best child of every block with UCB1Policy::SelectChild() and
+    // keeps the first of the lowest ones.
+    template <typename Tree>
+    static NodeIndex SelectChild(const Tree& tree, const VisitTables& tables, NodeIndex first, uint32_t size, int64_t parent_visits) noexcept {
+        // Every child scores the same.
+        if (parent_visits == 0) {
+            return first;
+        }
+        const auto parent_term = UCB1Policy::GetParentTerm(tables, parent_visits);
+        auto best = first;
+        auto best_ucb = std::numeric_limits<double>::quiet_NaN();
+        tree.ForEachChildBlock(first, size, [&](NodeIndex block, uint32_t count) {
+            const auto visits = tree.template GetColumn<int64_t>(block, kVisitsColumn);
+            const auto scores = tree.template GetColumn<double>(block, kScoreColumn);
+            const double* deviations = nullptr;
+            if constexpr (UCB1Policy::kTracksSquares) {
+                deviations = tree.template GetColumn<double>(block, kSquareColumn);
+            }
+            const auto i = UCB1Policy::SelectChild(tables, scores, visits, deviations, count, parent_visits);
+            double ucb = 0;
+            if constexpr (UCB1Policy::kTracksSquares) {
+                ucb = UCB1Policy::Evaluate(tables, scores[i], visits[i], deviations[i], parent_term);
+            }
+            else {
+                ucb = UCB1Policy::Evaluate(tables, scores[i], visits[i], parent_term);
+            }
+            if (block == first || best_ucb > ucb) {
+                best_ucb = ucb;
+                best = block + i;
+            }
+        });
+        return best;
+    }
+};
+
+// Nodes of the same position share one statistics record, looked up by
+// State::GetHashKey() in a transposition table. The tree keeps one node per
+// move sequence, so every node still has a single parent and backpropagation
+// follows the path the iteration selected, updating each shared record on it
+// once. A position cannot repeat on one path, so no record is counted twice.
+template <typename UCB1Policy>
+class TranspositionStats {
+public:
+    static constexpr uint32_t kColumns = 0;
+    static constexpr bool kConcurrent = false;
+
+    using table_type = TranspositionTable<UCB1Policy>;
+
+    // Reference from a node to its shared record.
+    class Handle {
+    public:
+        Handle() noexcept
+            : entry_(nullptr) {
+        }
+
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+
+        ~Handle() {
+            Reset(nullptr);
+        }
+
+        void Reset(typename table_type::Entry* entry) noexcept {
+            if (entry_ != nullptr) {
+                table_type::Release(entry_);
+            }
+            entry_ = entry;
+        }
+
+        [[nodiscard]] UCB1Policy& Get() noexcept {
+            return entry_->record;
+        }
+
+        [[nodiscard]] const UCB1Policy& Get() const noexcept {
+            return entry_->record;
+        }
+
+    private:
+        typename table_type::Entry* entry_;
+    };
+
+    using node_stats_type = Handle;
+
+    // Binds a new node to the record of its position.
+    template <typename Tree, typename State>
+    void Attach(Tree& tree, NodeIndex index, const State& state) {
+        tree[index].GetStats().Reset(table_.Acquire(state.GetHashKey()));
+    }
+
+    // Recycles the records no node refers to any more.
+    void Purge() {
+        table_.Purge();
+    }
+
+    [[nodiscard]] size_t GetTableSize() const {
+        return table_.GetSize();
+    }
+
+    template <typename Tree>
+    static int64_t GetVisits(const Tree& tree, NodeIndex index) noexcept {
+        return tree[index].GetStats().Get().GetVisits();
+    }
+
+    template <typename Tree>
+    static double GetScore(const Tree& tree, NodeIndex index) noexcept {
+        return tree[index].GetStats().Get().GetScore();
+    }
+
+    template <typename Tree>
+    static double GetDeviations(const Tree& tree, NodeIndex index) noexcept {
+        if constexpr (UCB1Policy::kTracksSquares) {
+            return tree[index].GetStats().Get().GetDeviations();
+        }
+        else {
+            return 0;
+        }
+    }
+
+    template <typename Tree>
+    static void Update(Tree& tree, NodeIndex index, const RewardStats& rewards) noexcept {
+        tree[index].GetStats().Get().Update(rewards);
+    }
+
+    // As in PerNodeStats, on the shared record.
+    template <typename Tree>
+    static void AddVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        tree[index].GetStats().Get().AddVirtualVisits(visits);
+    }
+
+    template <typename Tree>
+    static void RemoveVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        tree[index].GetStats().Get().AddVirtualVisits(-visits);
+    }
+
+    template <typename Tree>
+    static NodeIndex SelectChild(const Tree& tree, const VisitTables& tables, NodeIndex first, uint32_t size, int64_t parent_visits) noexcept {
+        const auto parent_term = UCB1Policy::GetParentTerm(tables, parent_visits);
+        const auto children = tree.GetChildRange(first, size);
+        auto itr = children.begin();
+        auto best = *itr;
+        auto best_ucb = tree[best].GetStats().Get()(tables, parent_term);
+        for (++itr; itr != children.end(); ++itr) {
+            const auto child = *itr;
+            const auto ucb = tree[child].GetStats().Get()(tables, parent_term);
+            if (best_ucb > ucb) {
+                best_ucb = ucb;
+                best = child;
+            }
+        }
+        return best;
+    }
+
+private:
+    table_type table_;
+};
+
+// Base of the lock-free records below. UCB1-Tuned merges each update's
+// deviations against the mean of the record, so its updates and reads go
+// through a SeqLock; other policies need nothing here.
+template <bool kTracksSquares>
+struct RecordLock {
+    mutable SeqLock lock;
+};
+
+template <>
+struct RecordLock<false> {
+};
+
+// Statistics in atomics so that iterations can select, expand and
+// backpropagate concurrently without a lock. Each field is updated on its
+// own, so a reader may see the visits of an update before its score. With
+// UCB1-Tuned a SeqLock keeps the visits, score and deviations of a record
+// together instead: updates of a node take turns, selection still reads
+// without locking.
+//
+// A thread walking down the tree adds virtual visits to every node on its
+// path and removes them when it backpropagates. GetBestUCBChild() picks the
+// lowest value, so a pending visit is scored as a win: it raises the value of
+// the path and steers other threads elsewhere until the real result is in.
+template <typename UCB1Policy>
+class AtomicStats {
+public:
+    static constexpr uint32_t kColumns = 0;
+    static constexpr bool kConcurrent = true;
+
+    class Record : public RecordLock<UCB1Policy::kTracksSquares> {
+    public:
+        Record() noexcept
+            : visits(0)
+            , virtual_visits(0)
+            , score(0)
+            , square(0) {
+        }
+
+        Record(const Record&) = delete;
+        Record& operator=(const Record&) = delete;
+
+        std::atomic<int64_t> visits;
+        std::atomic<int64_t> virtual_visits;
+        std::atomic<double> score;
+        std::atomic<double> square;
+    };
+
+    using node_stats_type = Record;
+
+    template <typename Tree, typename State>
+    static void Attach(Tree&, NodeIndex, const State&) noexcept {
+    }
+
+    static void Purge() noexcept {
+    }
+
+    template <typename Tree>
+    static int64_t GetVisits(const Tree& tree, NodeIndex index) noexcept {
+        return tree[index].GetStats().visits.load(std::memory_order_relaxed);
+    }
+
+    template <typename Tree>
+    static double GetScore(const Tree& tree, NodeIndex index) noexcept {
+        return tree[index].GetStats().score.load(std::memory_order_relaxed);
+    }
+
+    template <typename Tree>
+    static double GetDeviations(const Tree& tree, NodeIndex index) noexcept {
+        return tree[index].GetStats().square.load(std::memory_order_relaxed);
+    }
+
+    template <typename Tree>
+    static void Update(Tree& tree, NodeIndex index, const RewardStats& rewards) noexcept {
+        auto& record = tree[index].GetStats();
+        if constexpr (UCB1Policy::kTracksSquares) {
+            std::lock_guard guard{ record.lock };
+            auto score_sum = record.score.load(std::memory_order_relaxed);
+            auto visits_sum = record.visits.load(std::memory_order_relaxed);
+            auto square = record.square.load(std::memory_order_relaxed);
+            UCB1Policy::Accumulate(score_sum, visits_sum, square, rewards);
+            record.square.store(square, std::memory_order_relaxed);
+            record.score.store(score_sum, std::memory_order_relaxed);
+            record.visits.store(visits_sum, std::memory_order_relaxed);
+            return;
+        }
+        const auto score = rewards.GetSum();
+        auto current = record.score.load(std::memory_order_relaxed);
+        while (!record.score.compare_exchange_weak(current, current + score, std::memory_order_relaxed)) {
+        }
+        record.visits.fetch_add(rewards.GetCount(), std::memory_order_relaxed);
+    }
+
+    template <typename Tree>
+    static void AddVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        tree[index].GetStats().virtual_visits.fetch_add(visits, std::memory_order_relaxed);
+    }
+
+    template <typename Tree>
+    static void RemoveVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        tree[index].GetStats().virtual_visits.fetch_sub(visits, std::memory_order_relaxed);
+    }
+
+    // Children nobody has visited or is visiting yet were published by an
+    // expansion that has not added its virtual visits; they are skipped
+    // unless every child is in that state. The parent itself may not have
+    // a finished visit yet either.
+    template <typename Tree>
+    static NodeIndex SelectChild(const Tree& tree, const VisitTables& tables, NodeIndex first, uint32_t size, int64_t parent_visits) noexcept {
+        parent_visits = (std::max)(parent_visits, int64_t(1));
+        const auto parent_term = UCB1Policy::GetParentTerm(tables, parent_visits);
+        auto best = first;
+        auto best_ucb = (std::numeric_limits<double>::max)();
+        for (auto child : tree.GetChildRange(first, size)) {
+            const auto& record = tree[child].GetStats();
+            const auto pending = record.virtual_visits.load(std::memory_order_relaxed);
+            int64_t visits = 0;
+            double score = 0;
+            double square = 0;
+            if constexpr (UCB1Policy::kTracksSquares) {
+                std::tie(visits, score, square) = record.lock.Read([&record]() {
+                    return std::make_tuple(record.visits.load(std::memory_order_relaxed),
+                        record.score.load(std::memory_order_relaxed),
+                        record.square.load(std::memory_order_relaxed));
+                });
+            }
+            else {
+                visits = record.visits.load(std::memory_order_relaxed);
+                score = record.score.load(std::memory_order_relaxed);
+            }
+            visits += pending;
+            if (visits == 0) {
+                continue;
+            }
+            score += static_cast<double>(pending);
+            double ucb = 0;
+            if constexpr (UCB1Policy::kTracksSquares) {
+                ucb = UCB1Policy::Evaluate(tables, score, visits, square, parent_term);
+            }
+            else {
+                ucb = UCB1Policy::Evaluate(tables, score, visits, parent_term);
+            }
+            if (best_ucb > ucb) {
+                best_ucb = ucb;
+                best = child;
+            }
+        }
+        return best;
+    }
+};
+
+// Lock-free statistics whose visits and score live in one atomic 64-bit
+// word: the visits in the high half and the score in fixed point, in half
+// points, in the low half. A backpropagation adds both with one fetch_add
+// and a reader loads both at once, so selection never sees the visits of an
+// update without its score. Playout results are multiples of a half point
+// and are kept exactly; a node holds at most 2^31 visits. The virtual
+// visits are kept next to the word and may lag it by one update. The squared
+// deviations of UCB1-Tuned are kept next to it too, under a SeqLock as in
+// AtomicStats. Virtual loss works as in AtomicStats.
+template <typename UCB1Policy>
+class FixedPointStats {
+public:
+    static constexpr uint32_t kColumns = 0;
+    static constexpr bool kConcurrent = true;
+    static constexpr double kScoreScale = 2.0;
+    static constexpr uint32_t kVisitsShift = 32;
+    static constexpr uint64_t kScoreMask = (uint64_t(1) << kVisitsShift) - 1;
+
+    class Record : public RecordLock<UCB1Policy::kTracksSquares> {
+    public:
+        Record() noexcept
+            : counts(0)
+            , virtual_visits(0)
+            , square(0) {
+        }
+
+        Record(const Record&) = delete;
+        Record& operator=(const Record&) = delete;
+
+        std::atomic<uint64_t> counts;
+        std::atomic<int64_t> virtual_visits;
+        std::atomic<double> square;
+    };
+
+    using node_stats_type = Record;
+
+    template <typename Tree, typename State>
+    static void Attach(Tree&, NodeIndex, const State&) noexcept {
+    }
+
+    static void Purge() noexcept {
+    }
+
+    template <typename Tree>
+    static int64_t GetVisits(const Tree& tree, NodeIndex index) noexcept {
+        return GetVisits(tree[index].GetStats().counts.load(std::memory_order_relaxed));
+    }
+
+    template <typename Tree>
+    static double GetScore(const Tree& tree, NodeIndex index) noexcept {
+        return GetScore(tree[index].GetStats().counts.load(std::memory_order_relaxed));
+    }
+
+    template <typename Tree>
+    static double GetDeviations(const Tree& tree, NodeIndex index) noexcept {
+        return tree[index].GetStats().square.load(std::memory_order_relaxed);
+    }
+
+    // The sum of the rewards may be negative as long as the score of the
+    // node stays at or above zero.
+    template <typename Tree>
+    static void Update(Tree& tree, NodeIndex index, const RewardStats& rewards) noexcept {
+        auto& record = tree[index].GetStats();
+        const auto counts = (static_cast<uint64_t>(rewards.GetCount()) << kVisitsShift)
+            + static_cast<uint64_t>(std::llround(rewards.GetSum() * kScoreScale));
+        if constexpr (UCB1Policy::kTracksSquares) {
+            std::lock_guard guard{ record.lock };
+            const auto current = record.counts.load(std::memory_order_relaxed);
+            auto score_sum = GetScore(current);
+            auto visits_sum = GetVisits(current);
+            auto square = record.square.load(std::memory_order_relaxed);
+            UCB1Policy::Accumulate(score_sum, visits_sum, square, rewards);
+            record.square.store(square, std::memory_order_relaxed);
+            record.counts.store(current + counts, std::memory_order_relaxed);
+        }
+        else {
+            record.counts.fetch_add(counts, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename Tree>
+    static void AddVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        tree[index].GetStats().virtual_visits.fetch_add(visits, std::memory_order_relaxed);
+    }
+
+    template <typename Tree>
+    static void RemoveVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        tree[index].GetStats().virtual_visits.fetch_sub(visits, std::memory_order_relaxed);
+    }
+
+    // Skips children nobody has visited or is visiting yet, like
+    // AtomicStats::SelectChild().
+    template <typename Tree>
+    static NodeIndex SelectChild(const Tree& tree, const VisitTables& tables, NodeIndex first, uint32_t size, int64_t parent_visits) noexcept {
+        parent_visits = (std::max)(parent_visits, int64_t(1));
+        const auto parent_term = UCB1Policy::GetParentTerm(tables, parent_visits);
+        auto best = first;
+        auto best_ucb = (std::numeric_limits<double>::max)();
+        for (auto child : tree.GetChildRange(first, size)) {
+            const auto& record = tree[child].GetStats();
+            const auto pending = record.virtual_visits.load(std::memory_order_relaxed);
+            uint64_t counts = 0;
+            double square = 0;
+            if constexpr (UCB1Policy::kTracksSquares) {
+                std::tie(counts, square) = record.lock.Read([&record]() {
+                    return std::make_pair(record.counts.load(std::memory_order_relaxed),
+                        record.square.load(std::memory_order_relaxed));
+                });
+            }
+            else {
+                counts = record.counts.load(std::memory_order_relaxed);
+            }
+            const auto visits = GetVisits(counts) + pending;
+            if (visits == 0) {
+                continue;
+            }
+            const auto score = GetScore(counts) + static_cast<double>(pending);
+            double ucb = 0;
+            if constexpr (UCB1Policy::kTracksSquares) {
+                ucb = UCB1Policy::Evaluate(tables, score, visits, square, parent_term);
+            }
+            else {
+                ucb = UCB1Policy::Evaluate(tables, score, visits, parent_term);
+            }
+            if (best_ucb > ucb) {
+                best_ucb = ucb;
+                best = child;
+            }
+        }
+        return best;
+    }
+
+private:
+    static int64_t GetVisits(uint64_t counts) noexcept {
+        return static_cast<int64_t>(counts >> kVisitsShift);
+    }
+
+    static double GetScore(uint64_t counts) noexcept {
+        return static_cast<double>(counts & kScoreMask) / kScoreScale;
+    }
+};
+
+// Statistics behind a SpinLock per node, for SpinLockParallel. Every read
+// and update of a record holds its lock, so the visits, score and virtual
+// visits a reader sees always belong together. Virtual loss works as in
+// AtomicStats.
+template <typename UCB1Policy>
+class SpinLockStats {
+public:
+    static constexpr uint32_t kColumns = 0;
+    static constexpr bool kConcurrent = true;
+
+    class Record {
+    public:
+        Record() noexcept
+            : virtual_visits(0) {
+        }
+
+        Record(const Record&) = delete;
+        Record& operator=(const Record&) = delete;
+
+        mutable SpinLock lock;
+        UCB1Policy stats;
+        int64_t virtual_visits;
+    };
+
+    using node_stats_type = Record;
+
+    template <typename Tree, typename State>
+    static void Attach(Tree&, NodeIndex, const State&) noexcept {
+    }
+
+    static void Purge() noexcept {
+    }
+
+    template <typename Tree>
+    static int64_t GetVisits(const Tree& tree, NodeIndex index) noexcept {
+        const auto& record = tree[index].GetStats();
+        std::lock_guard guard{ record.lock };
+        return record.stats.GetVisits();
+    }
+
+    template <typename Tree>
+    static double GetScore(const Tree& tree, NodeIndex index) noexcept {
+        const auto& record = tree[index].GetStats();
+        std::lock_guard guard{ record.lock };
+        return record.stats.GetScore();
+    }
+
+    template <typename Tree>
+    static double GetDeviations(const Tree& tree, NodeIndex index) noexcept {
+        if constexpr (UCB1Policy::kTracksSquares) {
+            const auto& record = tree[index].GetStats();
+            std::lock_guard guard{ record.lock };
+            return record.stats.GetDeviations();
+        }
+        else {
+            return 0;
+        }
+    }
+
+    template <typename Tree>
+    static void Update(Tree& tree, NodeIndex index, const RewardStats& rewards) noexcept {
+        auto& record = tree[index].GetStats();
+        std::lock_guard guard{ record.lock };
+        record.stats.Update(rewards);
+    }
+
+    template <typename Tree>
+    static void AddVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        auto& record = tree[index].GetStats();
+        std::lock_guard guard{ record.lock };
+        record.virtual_visits += visits;
+    }
+
+    template <typename Tree>
+    static void RemoveVirtualLoss(Tree& tree, NodeIndex index, int32_t visits) noexcept {
+        auto& record = tree[index].GetStats();
+        std::lock_guard guard{ record.lock };
+        record.virtual_visits -= visits;
+    }
+
+    // Skips children nobody has visited or is visiting yet, like
+    // AtomicStats::SelectChild().
+    template <typename Tree>
+    static NodeIndex SelectChild(const Tree& tree, const VisitTables& tables, NodeIndex first, uint32_t size, int64_t parent_visits) noexcept {
+        parent_visits = (std::max)(parent_visits, int64_t(1));
+        const auto parent_term = UCB1Policy::GetParentTerm(tables, parent_visits);
+        auto best = first;
+        auto best_ucb = (std::numeric_limits<double>::max)();
+        for (auto child : tree.GetChildRange(first, size)) {
+            const auto& record = tree[child].GetStats();
+            int64_t visits = 0;
+            double score = 0;
+            double square = 0;
+            {
+                std::lock_guard guard{ record.lock };
+                visits = record.stats.GetVisits() + record.virtual_visits;
+                score = record.stats.GetScore() + static_cast<double>(record.virtual_visits);
+                if constexpr (UCB1Policy::kTracksSquares) {
+                    square = record.stats.GetDeviations();
+                }
+            }
+            if (visits == 0) {
+                continue;
+            }
+            double ucb = 0;
+            if constexpr (UCB1Policy::kTracksSquares) {
+                ucb = UCB1Policy::Evaluate(tables, score, visits, square, parent_term);
+            }
+            else {
+                ucb = UCB1Policy::Evaluate(tables, score, visits, parent_term);
+            }
+            if (best_ucb > ucb) {
+                best_ucb = ucb;
+                best = child;
+            }
+        }
+        return best;
+    }
+};
+
+}
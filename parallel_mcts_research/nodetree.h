@@ -0,0 +1,647 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "nodeallocator.h"
+
+namespace mcts {
+
+using NodeIndex = uint32_t;
+
+inline constexpr NodeIndex kInvalidNodeIndex = 0xFFFFFFFF;
+
+// Chunks hold at least 256 nodes and otherwise about 256KB, counting the
+// statistics columns stored after the nodes.
+template <typename NodeType, uint32_t kColumns>
+constexpr uint32_t NodeChunkShift() noexcept {
+    constexpr auto kNodeBytes = sizeof(NodeType) + kColumns * sizeof(uint64_t);
+    uint32_t shift = 8;
+    while ((kNodeBytes << (shift + 1)) <= 256 * 1024) {
+        ++shift;
+    }
+    return shift;
+}
+
+// Contiguous node storage addressed by 32-bit indices. Nodes live in
+// fixed-size chunks that never move. The children of a node occupy blocks
+// of 4, 8, 16, ... contiguous slots, each block inside a single chunk. A
+// block is reserved when the previous one is full and is cut to the moves
+// the node has left, so a node pays for about as many slots as it has
+// children instead of one slot per legal move. The first node of a block
+// links to the next block.
+//
+// Every chunk counts its live nodes plus one reference while a thread still
+// allocates from it. A chunk whose count drops to zero goes to a free list
+// and its memory and index are reused by the next chunk, so storage follows
+// the live tree instead of growing for the whole game.
+//
+// A chunk can also carry kColumns arrays of 8-byte values after its nodes,
+// one value per node, so per-node statistics can be stored as parallel
+// columns (see PackedStats). Columns are zeroed when a node is constructed.
+template <typename NodeType, typename NodeAllocator, uint32_t kColumns = 0>
+class NodeTree {
+public:
+    using node_type = NodeType;
+
+    static constexpr uint32_t kChunkShift = NodeChunkShift<NodeType, kColumns>();
+    static constexpr uint32_t kChunkSize = 1u << kChunkShift;
+    static constexpr uint32_t kMaxChunks = 1u << 16;
+    static constexpr size_t kCacheLineSize = 64;
+    static constexpr size_t kNodesBytes = (sizeof(node_type) * kChunkSize + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+    static constexpr size_t kColumnBytes = sizeof(uint64_t) * kChunkSize;
+    static constexpr size_t kChunkBytes = kNodesBytes + kColumnBytes * kColumns;
+    static constexpr uint32_t kFirstBlockSize = 4;
+
+    // Walks the children of a node across their blocks. The link to the next
+    // block is read on entering a block, so the nodes already passed may be
+    // destroyed during the walk.
+    class ChildIterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = NodeIndex;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const NodeIndex*;
+        using reference = NodeIndex;
+
+        ChildIterator(const NodeTree* tree, NodeIndex first, uint32_t size) noexcept
+            : tree_(tree)
+            , index_(kInvalidNodeIndex)
+            , next_block_(kInvalidNodeIndex)
+            , remaining_(size)
+            , block_size_(kFirstBlockSize)
+            , block_left_(0) {
+            if (remaining_ != 0) {
+                EnterBlock(first);
+            }
+        }
+
+        NodeIndex operator*() const noexcept {
+            return index_;
+        }
+
+        ChildIterator& operator++() noexcept {
+            if (--remaining_ == 0) {
+                return *this;
+            }
+            if (--block_left_ != 0) {
+                ++index_;
+            }
+            else {
+                block_size_ = GetNextBlockSize(block_size_);
+                EnterBlock(next_block_);
+            }
+            return *this;
+        }
+
+        bool operator==(const ChildIterator& other) const noexcept {
+            return remaining_ == other.remaining_;
+        }
+
+        bool operator!=(const ChildIterator& other) const noexcept {
+            return remaining_ != other.remaining_;
+        }
+
+    private:
+        void EnterBlock(NodeIndex block) noexcept {
+            index_ = block;
+            next_block_ = tree_->Get(block).GetNextBlock();
+            block_left_ = block_size_;
+        }
+
+        const NodeTree* tree_;
+        NodeIndex index_;
+        NodeIndex next_block_;
+        uint32_t remaining_;
+        uint32_t block_size_;
+        uint32_t block_left_;
+    };
+
+    class ChildRange {
+    public:
+        ChildRange(const NodeTree* tree, NodeIndex first, uint32_t size) noexcept
+            : tree_(tree)
+            , first_(first)
+            , size_(size) {
+        }
+
+        [[nodiscard]] ChildIterator begin() const noexcept {
+            return ChildIterator(tree_, first_, size_);
+        }
+
+        [[nodiscard]] ChildIterator end() const noexcept {
+            return ChildIterator(tree_, first_, 0);
+        }
+
+    private:
+        const NodeTree* tree_;
+        NodeIndex first_;
+        uint32_t size_;
+    };
+
+    NodeTree()
+        : root_(kInvalidNodeIndex)
+        , epoch_(1)
+        , chunk_count_(0)
+        , used_chunk_count_(0)
+        , node_count_(0)
+        , heap_bytes_(0)
+        , empty_slot_count_(0)
+        , constructed_count_(0)
+        , chunks_(new std::atomic<node_type*>[kMaxChunks])
+        , references_(new std::atomic<uint32_t>[kMaxChunks]) {
+        for (uint32_t i = 0; i < kMaxChunks; ++i) {
+            chunks_[i].store(nullptr, std::memory_order_relaxed);
+            references_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    NodeTree(const NodeTree&) = delete;
+    NodeTree& operator=(const NodeTree&) = delete;
+
+    ~NodeTree() {
+        if (root_ != kInvalidNodeIndex) {
+            DestroySubtree(root_);
+        }
+    }
+
+    template <typename... Args>
+    NodeIndex MakeRoot(Args&&... args) {
+        root_ = AllocateRange(1);
+        Construct(root_, std::forward<Args>(args)...);
+        return root_;
+    }
+
+    [[nodiscard]] NodeIndex GetRoot() const noexcept {
+        return root_;
+    }
+
+    // Makes new_root (a descendant of the current root) the root and returns
+    // the old root. Every node of the old root's subtree outside new_root's
+    // subtree is garbage afterwards and must be passed to DestroySubtree.
+    NodeIndex Reroot(NodeIndex new_root) noexcept {
+        const auto old_root = root_;
+        Get(new_root).SetParent(kInvalidNodeIndex);
+        root_ = new_root;
+        return old_root;
+    }
+
+    // Stops every thread from allocating in the chunk it currently uses, so
+    // those chunks can be recycled once their nodes die. No thread may be
+    // inside AllocateRange() while this runs.
+    void RetireOpenChunks() {
+        std::vector<uint32_t> open_chunks;
+        {
+            std::lock_guard guard{ chunk_mutex_ };
+            epoch_.fetch_add(1, std::memory_order_relaxed);
+            open_chunks.swap(open_chunks_);
+        }
+        for (auto chunk : open_chunks) {
+            Unreference(chunk);
+        }
+    }
+
+    // Reserves count contiguous slots. The slots hold no node until
+    // Construct() is called for them.
+    NodeIndex AllocateRange(uint32_t count) {
+        if (count > kChunkSize) {
+            throw std::length_error("Children range exceeds chunk size");
+        }
+        auto& cursor = cursors_.Get();
+        const auto epoch = epoch_.load(std::memory_order_relaxed);
+        if (cursor.epoch != epoch || cursor.end - cursor.next < count) {
+            const auto chunk = NewChunk(cursor.epoch == epoch ? cursor.chunk : kInvalidNodeIndex);
+            cursor.epoch = epoch;
+            cursor.chunk = chunk;
+            cursor.next = chunk << kChunkShift;
+            cursor.end = cursor.next + kChunkSize;
+        }
+        const auto first = cursor.next;
+        cursor.next += count;
+        empty_slot_count_.fetch_add(count, std::memory_order_relaxed);
+        return first;
+    }
+
+    // Returns the slot for child number size of the children starting at
+    // first, reserving a new block when the last one is full. remaining is
+    // the number of moves the node has left, counting this child; the node
+    // must never get more, since the last block may be cut to them.
+    NodeIndex ReserveChild(NodeIndex first, uint32_t size, uint32_t remaining) {
+        if (size == 0) {
+            return AllocateRange((std::min)(kFirstBlockSize, remaining));
+        }
+        auto block = first;
+        auto block_size = kFirstBlockSize;
+        while (size >= block_size) {
+            size -= block_size;
+            block_size = GetNextBlockSize(block_size);
+            const auto next = Get(block).GetNextBlock();
+            if (next == kInvalidNodeIndex) {
+                const auto new_block = AllocateRange((std::min)(block_size, remaining));
+                Get(block).SetNextBlock(new_block);
+                return new_block;
+            }
+            block = next;
+        }
+        return block + size;
+    }
+
+    // Children of the node at index. Safe while another thread expands it.
+    [[nodiscard]] ChildRange GetChildren(NodeIndex index) const noexcept {
+        const auto& node = Get(index);
+        const auto size = node.GetChildrenSize();
+        return ChildRange(this, node.GetFirstChild(), size);
+    }
+
+    [[nodiscard]] ChildRange GetChildRange(NodeIndex first, uint32_t size) const noexcept {
+        return ChildRange(this, first, size);
+    }
+
+    // Calls function(block, count) for the count children stored from block
+    // on, block by block.
+    template <typename Function>
+    void ForEachChildBlock(NodeIndex first, uint32_t size, Function&& function) const {
+        auto block = first;
+        auto block_size = kFirstBlockSize;
+        while (size != 0) {
+            const auto count = (std::min)(size, block_size);
+            const auto next = Get(block).GetNextBlock();
+            function(block, count);
+            size -= count;
+            block = next;
+            block_size = GetNextBlockSize(block_size);
+        }
+    }
+
+    [[nodiscard]] NodeIndex GetChild(NodeIndex first, uint32_t i) const noexcept {
+        auto block = first;
+        auto block_size = kFirstBlockSize;
+        while (i >= block_size) {
+            i -= block_size;
+            block = Get(block).GetNextBlock();
+            block_size = GetNextBlockSize(block_size);
+        }
+        return block + i;
+    }
+
+    // Slots reserved for a node with children_size children and untried_size
+    // untried moves: the full blocks before the last one, and the last one
+    // as cut when it was reserved.
+    [[nodiscard]] static uint64_t GetReservedSize(uint32_t children_size, uint32_t untried_size) noexcept {
+        if (children_size == 0) {
+            return 0;
+        }
+        uint64_t start = 0;
+        uint32_t block_size = kFirstBlockSize;
+        while (children_size - start > block_size) {
+            start += block_size;
+            block_size = GetNextBlockSize(block_size);
+        }
+        return start + (std::min)(static_cast<uint64_t>(block_size), children_size - start + untried_size);
+    }
+
+    template <typename... Args>
+    node_type& Construct(NodeIndex index, Args&&... args) {
+        auto node = new (&Get(index)) node_type(std::forward<Args>(args)...);
+        for (uint32_t column = 0; column < kColumns; ++column) {
+            *GetColumn<uint64_t>(index, column) = 0;
+        }
+        references_[index >> kChunkShift].fetch_add(1, std::memory_order_relaxed);
+        node_count_.fetch_add(1, std::memory_order_relaxed);
+        constructed_count_.fetch_add(1, std::memory_order_relaxed);
+        empty_slot_count_.fetch_sub(1, std::memory_order_relaxed);
+        heap_bytes_.fetch_add(node->GetHeapBytes(), std::memory_order_relaxed);
+        return *node;
+    }
+
+    // Tells the heap accounting that a node's state changed from holding
+    // old_bytes to new_bytes, e.g. after Node::SetState().
+    void UpdateHeapBytes(size_t old_bytes, size_t new_bytes) noexcept {
+        heap_bytes_.fetch_add(new_bytes - old_bytes, std::memory_order_relaxed);
+    }
+
+    // Gives up the slots index reserved for children it has not made yet.
+    // Call before its children are dropped; DestroySubtree() calls it.
+    void ReleaseEmptySlots(NodeIndex index) noexcept {
+        const auto& node = Get(index);
+        const auto children_size = node.GetChildrenSize();
+        const auto reserved = GetReservedSize(children_size, node.GetMovesSize());
+        empty_slot_count_.fetch_sub(reserved - children_size, std::memory_order_relaxed);
+    }
+
+    // Destroys index and every node below it, except the subtree of keep.
+    // Safe to run on another thread while searches work below keep.
+    void DestroySubtree(NodeIndex index, NodeIndex keep = kInvalidNodeIndex) noexcept {
+        if (index == keep) {
+            return;
+        }
+        for (auto child : GetChildren(index)) {
+            DestroySubtree(child, keep);
+        }
+        ReleaseEmptySlots(index);
+        auto& node = Get(index);
+        heap_bytes_.fetch_sub(node.GetHeapBytes(), std::memory_order_relaxed);
+        node.~node_type();
+        node_count_.fetch_sub(1, std::memory_order_relaxed);
+        Unreference(index >> kChunkShift);
+    }
+
+    node_type& Get(NodeIndex index) noexcept {
+        return chunks_[index >> kChunkShift].load(std::memory_order_acquire)[index & (kChunkSize - 1)];
+    }
+
+    const node_type& Get(NodeIndex index) const noexcept {
+        return chunks_[index >> kChunkShift].load(std::memory_order_acquire)[index & (kChunkSize - 1)];
+    }
+
+    // Returns the value of index in the given statistics column. Consecutive
+    // indices inside one chunk are consecutive in memory.
+    template <typename T>
+    T* GetColumn(NodeIndex index, uint32_t column) noexcept {
+        static_assert(sizeof(T) == sizeof(uint64_t), "Column values are 8 bytes");
+        auto chunk = reinterpret_cast<char*>(chunks_[index >> kChunkShift].load(std::memory_order_acquire));
+        return reinterpret_cast<T*>(chunk + kNodesBytes + kColumnBytes * column) + (index & (kChunkSize - 1));
+    }
+
+    template <typename T>
+    const T* GetColumn(NodeIndex index, uint32_t column) const noexcept {
+        static_assert(sizeof(T) == sizeof(uint64_t), "Column values are 8 bytes");
+        auto chunk = reinterpret_cast<const char*>(chunks_[index >> kChunkShift].load(std::memory_order_acquire));
+        return reinterpret_cast<const T*>(chunk + kNodesBytes + kColumnBytes * column) + (index & (kChunkSize - 1));
+    }
+
+    node_type& operator[](NodeIndex index) noexcept {
+        return Get(index);
+    }
+
+    const node_type& operator[](NodeIndex index) const noexcept {
+        return Get(index);
+    }
+
+    [[nodiscard]] size_t GetNodeCount() const noexcept {
+        return node_count_.load(std::memory_order_relaxed);
+    }
+
+    // Bytes requested from the allocator and nodes ever constructed; both
+    // only grow, so two snapshots can be subtracted.
+    [[nodiscard]] AllocationStats GetStats() const noexcept {
+        auto stats = allocator_.GetStats();
+        stats.nodes = constructed_count_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    // Chunks holding nodes or handed to an allocating thread. Read without
+    // a lock, so a search may be changing it.
+    [[nodiscard]] size_t GetChunkCount() const noexcept {
+        return used_chunk_count_.load(std::memory_order_relaxed);
+    }
+
+    // Heap memory owned by the live nodes, as reported by their
+    // GetHeapBytes() when they were constructed or last updated.
+    [[nodiscard]] size_t GetHeapBytes() const noexcept {
+        return heap_bytes_.load(std::memory_order_relaxed);
+    }
+
+    // Slots reserved for children that were not made yet.
+    [[nodiscard]] size_t GetEmptySlotCount() const noexcept {
+        return empty_slot_count_.load(std::memory_order_relaxed);
+    }
+
+    // Memory the tree holds for its live nodes: the chunks in use and the
+    // heap owned by the nodes.
+    [[nodiscard]] size_t GetMemoryUsage() const noexcept {
+        return GetChunkCount() * kChunkBytes + GetHeapBytes();
+    }
+
+    [[nodiscard]] size_t GetFreeChunkCount() const noexcept {
+        std::lock_guard guard{ chunk_mutex_ };
+        return free_chunks_.size();
+    }
+
+private:
+    struct ChunkCursor {
+        uint32_t epoch = 0;
+        uint32_t chunk = 0;
+        NodeIndex next = 0;
+        NodeIndex end = 0;
+    };
+
+    static constexpr uint32_t GetNextBlockSize(uint32_t block_size) noexcept {
+        return (std::min)(block_size * 2, kChunkSize);
+    }
+
+    // Hands out a chunk for the calling thread and drops the thread's
+    // reference to full_chunk, the chunk it used so far.
+    NodeIndex NewChunk(uint32_t full_chunk) {
+        uint32_t chunk = 0;
+        {
+            std::lock_guard guard{ chunk_mutex_ };
+            if (full_chunk != kInvalidNodeIndex) {
+                open_chunks_.erase(std::find(open_chunks_.begin(), open_chunks_.end(), full_chunk));
+            }
+            if (!free_chunks_.empty()) {
+                chunk = free_chunks_.back();
+                free_chunks_.pop_back();
+            }
+            else {
+                chunk = chunk_count_.fetch_add(1, std::memory_order_relaxed);
+                if (chunk >= kMaxChunks) {
+                    throw std::bad_alloc();
+                }
+                auto memory = allocator_.Allocate(kChunkBytes, (std::max)(alignof(node_type), kCacheLineSize));
+                chunks_[chunk].store(static_cast<node_type*>(memory), std::memory_order_release);
+            }
+            references_[chunk].store(1, std::memory_order_relaxed);
+            used_chunk_count_.fetch_add(1, std::memory_order_relaxed);
+            open_chunks_.push_back(chunk);
+        }
+        if (full_chunk != kInvalidNodeIndex) {
+            Unreference(full_chunk);
+        }
+        return chunk;
+    }
+
+    void Unreference(uint32_t chunk) {
+        if (references_[chunk].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard guard{ chunk_mutex_ };
+            free_chunks_.push_back(chunk);
+            used_chunk_count_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    PerThread<ChunkCursor> cursors_;
+    NodeIndex root_;
+    std::atomic<uint32_t> epoch_;
+    std::atomic<uint32_t> chunk_count_;
+    std::atomic<size_t> used_chunk_count_;
+    std::atomic<size_t> node_count_;
+    std::atomic<size_t> heap_bytes_;
+    std::atomic<size_t> empty_slot_count_;
+    std::atomic<size_t> constructed_count_;
+    NodeAllocator allocator_;
+    std::unique_ptr<std::atomic<node_type*>[]> chunks_;
+    std::unique_ptr<std::atomic<uint32_t>[]> references_;
+    mutable FastMutex chunk_mutex_;
+    std::vector<uint32_t> open_chunks_;
+    std::vector<uint32_t> free_chunks_;
+};
+
+// Read-only handle to a node of a NodeTree. Copying a view never touches a
+// reference count. Stats reads the statistics wherever the layout keeps them.
+template <typename Tree, typename Stats>
+class NodeView {
+public:
+    using node_type = typename Tree::node_type;
+    using state_type = typename node_type::state_type;
+    using move_type = typename node_type::move_type;
+
+    class Iterator {
+    public:
+        Iterator(Tree* tree, typename Tree::ChildIterator child) noexcept
+            : tree_(tree)
+            , child_(child) {
+        }
+
+        NodeView operator*() const noexcept {
+            return NodeView(tree_, *child_);
+        }
+
+        Iterator& operator++() noexcept {
+            ++child_;
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const noexcept {
+            return child_ == other.child_;
+        }
+
+        bool operator!=(const Iterator& other) const noexcept {
+            return child_ != other.child_;
+        }
+
+    private:
+        Tree* tree_;
+        typename Tree::ChildIterator child_;
+    };
+
+    class Range {
+    public:
+        Range(Tree* tree, NodeIndex first, uint32_t size) noexcept
+            : tree_(tree)
+            , first_(first)
+            , size_(size) {
+        }
+
+        [[nodiscard]] Iterator begin() const noexcept {
+            return Iterator(tree_, typename Tree::ChildIterator(tree_, first_, size_));
+        }
+
+        [[nodiscard]] Iterator end() const noexcept {
+            return Iterator(tree_, typename Tree::ChildIterator(tree_, first_, 0));
+        }
+
+        [[nodiscard]] size_t size() const noexcept {
+            return size_;
+        }
+
+        [[nodiscard]] bool empty() const noexcept {
+            return size_ == 0;
+        }
+
+        NodeView operator[](size_t i) const noexcept {
+            return NodeView(tree_, tree_->GetChild(first_, static_cast<uint32_t>(i)));
+        }
+
+    private:
+        Tree* tree_;
+        NodeIndex first_;
+        uint32_t size_;
+    };
+
+    NodeView(Tree* tree, NodeIndex index) noexcept
+        : tree_(tree)
+        , index_(index) {
+    }
+
+    // Keeps the node_ptr style call sites (node->GetWinRate()) working.
+    const NodeView* operator->() const noexcept {
+        return this;
+    }
+
+    explicit operator bool() const noexcept {
+        return index_ != kInvalidNodeIndex;
+    }
+
+    [[nodiscard]] NodeIndex GetIndex() const noexcept {
+        return index_;
+    }
+
+    [[nodiscard]] NodeView GetParent() const noexcept {
+        return NodeView(tree_, Node().GetParent());
+    }
+
+    [[nodiscard]] Range GetChildren() const noexcept {
+        const auto size = Node().GetChildrenSize();
+        return Range(tree_, Node().GetFirstChild(), size);
+    }
+
+    [[nodiscard]] size_t GetChildrenSize() const noexcept {
+        return Node().GetChildrenSize();
+    }
+
+    [[nodiscard]] double GetScore() const noexcept {
+        return Stats::GetScore(*tree_, index_);
+    }
+
+    [[nodiscard]] int64_t GetVisits() const noexcept {
+        return Stats::GetVisits(*tree_, index_);
+    }
+
+    [[nodiscard]] double GetDeviations() const noexcept {
+        return Stats::GetDeviations(*tree_, index_);
+    }
+
+    [[nodiscard]] double GetWinRate() const {
+        return GetScore() / static_cast<double>(GetVisits());
+    }
+
+    [[nodiscard]] const move_type& GetLastMove() const noexcept {
+        return Node().GetLastMove();
+    }
+
+    [[nodiscard]] int8_t GetPlayerID() const noexcept {
+        return Node().GetPlayerID();
+    }
+
+    [[nodiscard]] const state_type& GetState() const {
+        return Node().GetState();
+    }
+
+    bool operator==(const NodeView& other) const noexcept {
+        return tree_ == other.tree_ && index_ == other.index_;
+    }
+
+    bool operator!=(const NodeView& other) const noexcept {
+        return !(*this == other);
+    }
+
+private:
+    const node_type& Node() const noexcept {
+        return tree_->Get(index_);
+    }
+
+    Tree* tree_;
+    NodeIndex index_;
+};
+
+}
@@ -25,7 +25,21 @@ CONFIG(debug, debug|release) {
 HEADERS += \
     rng.h \
     node.h \
+    boundedqueue.h \
+    nodeallocator.h \
+    nodestats.h \
+    parallelpolicy.h \
+    nodetree.h \
     mcts.h \
+    subtreereclaimer.h \
+    timemanager.h \
+    searchhandle.h \
+    perfcounter.h \
+    rootparallel.h \
+    searchservice.h \
     threadpool.h \
+    transpositiontable.h \
+    ucbkernel.h \
+    untriedmoves.h \
     games\gomoku\gamestate.h \
     games\tictactoe\gamestate.h \
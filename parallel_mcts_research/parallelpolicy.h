@@ -0,0 +1,217 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace mcts {
+
+// Spin-wait hint for the CPU.
+inline void Pause() noexcept {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+// Test and test-and-set lock for critical sections a few instructions long.
+// Gives up the time slice after a while, so a preempted holder gets to run.
+class SpinLock final {
+public:
+    static constexpr int32_t kSpinCount = 64;
+
+    SpinLock() noexcept
+        : locked_(false) {
+    }
+
+    SpinLock(const SpinLock&) = delete;
+    SpinLock& operator=(const SpinLock&) = delete;
+
+    void lock() noexcept {
+        for (;;) {
+            if (!locked_.exchange(true, std::memory_order_acquire)) {
+                return;
+            }
+            for (auto i = 0; locked_.load(std::memory_order_relaxed); ++i) {
+                if (i < kSpinCount) {
+                    Pause();
+                }
+                else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    void unlock() noexcept {
+        locked_.store(false, std::memory_order_release);
+    }
+
+    [[nodiscard]] bool try_lock() noexcept {
+        return !locked_.load(std::memory_order_relaxed)
+            && !locked_.exchange(true, std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<bool> locked_;
+};
+
+// Sequence lock for small records that are read far more often than
+// written. Writers lock it like a SpinLock and keep the count odd while they
+// update; Read() copies the record without locking and retries if a writer
+// got in between. The fields themselves must be atomics, loaded and stored
+// relaxed.
+class SeqLock final {
+public:
+    SeqLock() noexcept
+        : sequence_(0) {
+    }
+
+    SeqLock(const SeqLock&) = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+
+    void lock() noexcept {
+        auto sequence = sequence_.load(std::memory_order_relaxed);
+        for (auto i = 0;; ++i) {
+            if ((sequence & 1) == 0
+                && sequence_.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                // Keeps the stores of the update after the odd count.
+                std::atomic_thread_fence(std::memory_order_release);
+                return;
+            }
+            Wait(i);
+            sequence = sequence_.load(std::memory_order_relaxed);
+        }
+    }
+
+    void unlock() noexcept {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Returns read() from a moment no writer held the lock.
+    template <typename Reader>
+    auto Read(Reader&& read) const noexcept {
+        for (auto i = 0;; ++i) {
+            const auto sequence = sequence_.load(std::memory_order_acquire);
+            if ((sequence & 1) == 0) {
+                const auto value = read();
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence_.load(std::memory_order_relaxed) == sequence) {
+                    return value;
+                }
+            }
+            Wait(i);
+        }
+    }
+
+private:
+    static void Wait(int32_t i) noexcept {
+        if (i < SpinLock::kSpinCount) {
+            Pause();
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+
+    std::atomic<uint64_t> sequence_;
+};
+
+// Stand-ins for the members of MCTS a strategy does not need: a mutex whose
+// lock does nothing and a counter that holds nothing. MCTS picks them with
+// std::conditional_t and skips the code using them with if constexpr.
+class NullMutex final {
+public:
+    void lock() noexcept {
+    }
+
+    void unlock() noexcept {
+    }
+
+    [[nodiscard]] bool try_lock() noexcept {
+        return true;
+    }
+};
+
+struct NullCounter {
+};
+
+// Parallelization strategies for the ParallelPolicy parameter of MCTS. They
+// decide how ParallelSearch() and SearchAsync() share the tree between
+// threads; synchronization a strategy does not need is not compiled in. In
+// every strategy the rollouts of a leaf are spread over rollout_tp.
+//
+// kConcurrentTree: select threads walk the tree at the same time without
+// root_mutex_, which needs a concurrent stats layout.
+// kLocksTree: every iteration holds root_mutex_. Only these strategies
+// have root_mutex_ and count the iterations in flight.
+// kSingleWalker: one select thread walks the tree. These strategies have no
+// structure_mutex_, since GetTreeStats() may not run during their searches.
+// kPipelined: selection, rollouts and backpropagation run as separate
+// stages connected by queues.
+
+// Tree parallelization under one lock. Every select thread runs whole
+// iterations under root_mutex_. Works with every stats layout.
+struct GlobalLockParallel {
+    static constexpr bool kConcurrentTree = false;
+    static constexpr bool kLocksTree = true;
+    static constexpr bool kSingleWalker = false;
+    static constexpr bool kPipelined = false;
+};
+
+// Tree parallelization with a lock per node: the statistics of every node
+// sit behind a SpinLock of their own (SpinLockStats), and expansions are
+// claimed per node.
+struct SpinLockParallel {
+    static constexpr bool kConcurrentTree = true;
+    static constexpr bool kLocksTree = false;
+    static constexpr bool kSingleWalker = false;
+    static constexpr bool kPipelined = false;
+};
+
+// Lock-free tree parallelization on atomic statistics with virtual loss
+// (AtomicStats, or FixedPointStats for consistent visits and scores).
+struct LockFreeParallel {
+    static constexpr bool kConcurrentTree = true;
+    static constexpr bool kLocksTree = false;
+    static constexpr bool kSingleWalker = false;
+    static constexpr bool kPipelined = false;
+};
+
+// Pipelined tree parallelization: select_tp threads select and expand
+// leaves concurrently and queue them, rollout_tp threads play them out and
+// queue the results, and the searching thread backpropagates them in
+// batches. Needs a concurrent stats layout, like LockFreeParallel.
+struct PipelineParallel {
+    static constexpr bool kConcurrentTree = true;
+    static constexpr bool kLocksTree = false;
+    static constexpr bool kSingleWalker = false;
+    static constexpr bool kPipelined = true;
+};
+
+// Leaf parallelization: one thread walks the tree and only the rollouts run
+// in parallel, so iterations take no lock at all.
+struct LeafParallel {
+    static constexpr bool kConcurrentTree = false;
+    static constexpr bool kLocksTree = false;
+    static constexpr bool kSingleWalker = true;
+    static constexpr bool kPipelined = false;
+};
+
+// Root parallelization: RootParallelMCTS gives every worker a tree of its
+// own and never runs two iterations of one tree at a time, so its worker
+// engines take no lock either. Used on its own, an engine with this policy
+// searches like LeafParallel.
+struct RootParallel {
+    static constexpr bool kConcurrentTree = false;
+    static constexpr bool kLocksTree = false;
+    static constexpr bool kSingleWalker = true;
+    static constexpr bool kPipelined = false;
+};
+
+}
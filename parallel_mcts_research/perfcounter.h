@@ -0,0 +1,87 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <cstdint>
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace mcts {
+
+// Counts data TLB read misses of the calling thread and of every thread it
+// starts while the counter is open. Counts of other threads are folded in
+// when they exit, so join the workers before calling Read(). Only available
+// on Linux with perf events enabled.
+class TlbMissCounter {
+public:
+    TlbMissCounter() noexcept
+        : fd_(-1) {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    TlbMissCounter(const TlbMissCounter&) = delete;
+    TlbMissCounter& operator=(const TlbMissCounter&) = delete;
+
+    ~TlbMissCounter() {
+#ifdef __linux__
+        if (fd_ != -1) {
+            ::close(fd_);
+        }
+#endif
+    }
+
+    [[nodiscard]] bool IsAvailable() const noexcept {
+        return fd_ != -1;
+    }
+
+    void Start() noexcept {
+#ifdef __linux__
+        if (fd_ != -1) {
+            ::ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void Stop() noexcept {
+#ifdef __linux__
+        if (fd_ != -1) {
+            ::ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        }
+#endif
+    }
+
+    [[nodiscard]] uint64_t Read() const noexcept {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (fd_ != -1 && ::read(fd_, &count, sizeof(count)) != sizeof(count)) {
+            count = 0;
+        }
+#endif
+        return count;
+    }
+
+private:
+    int fd_;
+};
+
+}
@@ -15,6 +15,20 @@ public:
     inline T operator()(T min, T max) noexcept {
         return std::uniform_int_distribution(min, max)(engine_);
     }
+
+    // Restarts the calling thread's stream from seed.
+    void Seed(uint64_t seed) {
+        engine_.seed(seed);
+    }
+
+    // Seed of stream number stream of seed. Neighbouring streams get
+    // unrelated seeds (SplitMix64 finalizer).
+    static constexpr uint64_t GetStreamSeed(uint64_t seed, uint64_t stream) noexcept {
+        auto z = seed + 0x9E3779B97F4A7C15ULL * (stream + 1);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
 private:
 	RNG() noexcept;
     std::mt19937_64 engine_;
@@ -0,0 +1,239 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include "mcts.h"
+
+namespace mcts {
+
+// Root parallelization: every worker searches a tree of its own, so workers
+// never share a node or a lock. Each worker's iterations run on one select
+// thread at a time and draw from that thread's RNG, so the trees grow apart.
+//
+// Every sync interval the workers stop and the reward statistics of the root
+// children are merged: each tree receives what the other trees found for the
+// children it has, which steers its next iterations. After the search the
+// move with the best merged win rate is played in every tree.
+//
+// The worker engines use the RootParallel policy: no tree is walked by two
+// threads at once, so their iterations take no lock.
+template
+<
+    typename State,
+    typename Move,
+    typename UCB1Policy = DefaultUCB1Policy,
+    typename NodeAllocator = ArenaNodeAllocator,
+    template <typename, typename> class NodeState = StoredNodeState,
+    template <typename> class StatsLayout = PerNodeStats
+>
+class RootParallelMCTS {
+public:
+    using engine_type = MCTS<State, Move, UCB1Policy, NodeAllocator, NodeState, StatsLayout, RootParallel>;
+
+    RootParallelMCTS(size_t workers,
+                     int32_t evaluate_count = engine_type::kMaxEvaluateCount,
+                     int32_t rollout_limit = engine_type::kMaxRolloutCount)
+        : evaluate_count_(evaluate_count)
+        , sync_interval_(0)
+        , shared_(workers) {
+        for (size_t i = 0; i < workers; ++i) {
+            workers_.push_back(std::make_unique<engine_type>(evaluate_count, rollout_limit));
+        }
+    }
+
+    RootParallelMCTS(const State& state,
+                     size_t workers,
+                     int32_t evaluate_count = engine_type::kMaxEvaluateCount,
+                     int32_t rollout_limit = engine_type::kMaxRolloutCount)
+        : evaluate_count_(evaluate_count)
+        , sync_interval_(0)
+        , shared_(workers) {
+        for (size_t i = 0; i < workers; ++i) {
+            workers_.push_back(std::make_unique<engine_type>(state, evaluate_count, rollout_limit));
+        }
+    }
+
+    RootParallelMCTS(const RootParallelMCTS&) = delete;
+    RootParallelMCTS& operator=(const RootParallelMCTS&) = delete;
+
+    // evaluate_count is the total over all workers.
+    void SetSearchLimit(int32_t evaluate_count, int32_t rollout_limit) {
+        evaluate_count_ = evaluate_count;
+        for (auto& worker : workers_) {
+            worker->SetSearchLimit(evaluate_count, rollout_limit);
+        }
+    }
+
+    // Seeds every worker with a stream of seed of its own, see
+    // MCTS::SetSeed(). The workers keep running in parallel and the search
+    // still builds the same trees whatever the thread count.
+    void SetSeed(uint64_t seed) noexcept {
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            workers_[i]->SetSeed(RNG::GetStreamSeed(seed, i));
+        }
+    }
+
+    // Iterations each worker runs between two merges. 0 merges once, after
+    // the search.
+    void SetSyncInterval(int32_t iterations) noexcept {
+        sync_interval_ = iterations;
+    }
+
+    Move ParallelSearch(ThreadPool& select_tp, ThreadPool& rollout_tp, milliseconds search_time = milliseconds(30000)) {
+        const auto workers = static_cast<int32_t>(workers_.size());
+        const auto deadline = steady_clock::now() + search_time;
+        auto remaining = (evaluate_count_ + workers - 1) / workers;
+        auto totals = Merge();
+        while (remaining > 0 && steady_clock::now() <= deadline) {
+            const auto round = sync_interval_ > 0 ? (std::min)(sync_interval_, remaining) : remaining;
+            mcts::ParallelFor(select_tp, workers, [this, round, deadline, &rollout_tp](int32_t i) {
+                workers_[i]->Search(rollout_tp, round, deadline);
+            });
+            remaining -= round;
+            totals = Merge();
+        }
+        // Children no worker visited yet have no win rate to compare.
+        auto best = totals.end();
+        for (auto itr = totals.begin(); itr != totals.end(); ++itr) {
+            if (itr->visits == 0) {
+                continue;
+            }
+            if (best == totals.end()
+                || itr->score / static_cast<double>(itr->visits) > best->score / static_cast<double>(best->visits)) {
+                best = itr;
+            }
+        }
+        if (best == totals.end()) {
+            throw std::logic_error("Search stopped before any move was tried");
+        }
+        const auto best_move = best->move;
+        Play(best_move);
+        return best_move;
+    }
+
+    void SetOpponentMove(const Move& opponent_move) {
+        Play(opponent_move);
+    }
+
+    [[nodiscard]] size_t GetWorkerCount() const noexcept {
+        return workers_.size();
+    }
+
+    [[nodiscard]] const engine_type& GetWorker(size_t i) const noexcept {
+        return *workers_[i];
+    }
+
+private:
+    // Sums of the rewards, which unlike the squared deviations can be
+    // subtracted from one another.
+    struct MoveStats {
+        MoveStats(const Move& move, double score, int64_t visits, double squares)
+            : move(move)
+            , score(score)
+            , visits(visits)
+            , squares(squares) {
+        }
+
+        // The rewards between two snapshots of a child.
+        [[nodiscard]] RewardStats GetRewards() const noexcept {
+            const auto deviations = squares - score * score / static_cast<double>(visits);
+            return RewardStats(visits, score, (std::max)(deviations, 0.0));
+        }
+
+        Move move;
+        double score;
+        int64_t visits;
+        double squares;
+    };
+
+    static MoveStats* Find(std::vector<MoveStats>& stats, const Move& move) noexcept {
+        for (auto& entry : stats) {
+            if (entry.move == move) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    // Returns the root children statistics summed over the workers. Each
+    // worker's own share is its tree minus what earlier merges added to it.
+    std::vector<MoveStats> Merge() {
+        std::vector<std::vector<MoveStats>> own(workers_.size());
+        std::vector<MoveStats> totals;
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            for (const auto& child : workers_[i]->GetChildren()) {
+                auto score = child.GetScore();
+                auto visits = child.GetVisits();
+                auto squares = visits > 0
+                    ? child.GetDeviations() + score * score / static_cast<double>(visits) : 0.0;
+                if (const auto shared = Find(shared_[i], child.GetLastMove())) {
+                    score -= shared->score;
+                    visits -= shared->visits;
+                    squares -= shared->squares;
+                }
+                own[i].emplace_back(child.GetLastMove(), score, visits, squares);
+                if (auto total = Find(totals, child.GetLastMove())) {
+                    total->score += score;
+                    total->visits += visits;
+                    total->squares += squares;
+                }
+                else {
+                    totals.emplace_back(child.GetLastMove(), score, visits, squares);
+                }
+            }
+        }
+        if (workers_.size() == 1) {
+            return totals;
+        }
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            for (const auto& total : totals) {
+                auto score = total.score;
+                auto visits = total.visits;
+                auto squares = total.squares;
+                if (const auto mine = Find(own[i], total.move)) {
+                    score -= mine->score;
+                    visits -= mine->visits;
+                    squares -= mine->squares;
+                }
+                auto shared = Find(shared_[i], total.move);
+                const MoveStats added(total.move,
+                                      score - (shared != nullptr ? shared->score : 0),
+                                      visits - (shared != nullptr ? shared->visits : 0),
+                                      squares - (shared != nullptr ? shared->squares : 0));
+                if (added.visits <= 0
+                    || !workers_[i]->AddChildStats(total.move, added.GetRewards())) {
+                    continue;
+                }
+                if (shared != nullptr) {
+                    shared->score = score;
+                    shared->visits = visits;
+                    shared->squares = squares;
+                }
+                else {
+                    shared_[i].emplace_back(total.move, score, visits, squares);
+                }
+            }
+        }
+        return totals;
+    }
+
+    void Play(const Move& move) {
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            workers_[i]->SetOpponentMove(move);
+            shared_[i].clear();
+        }
+    }
+
+    int32_t evaluate_count_;
+    int32_t sync_interval_;
+    // Statistics each worker received from the others, per root child.
+    std::vector<std::vector<MoveStats>> shared_;
+    std::vector<std::unique_ptr<engine_type>> workers_;
+};
+
+}
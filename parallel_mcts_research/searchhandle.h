@@ -0,0 +1,113 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <future>
+
+namespace mcts {
+
+// Limits of one asynchronous search.
+struct SearchBudget {
+    SearchBudget() noexcept
+        : iterations(0)
+        , time(30000)
+        , progress_interval(1000) {
+    }
+
+    SearchBudget(int32_t iterations,
+                 std::chrono::milliseconds time,
+                 std::chrono::milliseconds progress_interval = std::chrono::milliseconds(1000)) noexcept
+        : iterations(iterations)
+        , time(time)
+        , progress_interval(progress_interval) {
+    }
+
+    // 0 uses the evaluate count of the engine.
+    int32_t iterations;
+    std::chrono::milliseconds time;
+    // Time between two progress callbacks.
+    std::chrono::milliseconds progress_interval;
+};
+
+// State of a running search passed to the progress callback.
+template <typename Move>
+struct SearchProgress {
+    SearchProgress()
+        : iterations(0)
+        , elapsed(0)
+        , has_best_move(false)
+        , best_move()
+        , win_rate(0)
+        , nodes_per_second(0) {
+    }
+
+    int32_t iterations;
+    std::chrono::milliseconds elapsed;
+    // False until a child of the current node has a result.
+    bool has_best_move;
+    Move best_move;
+    double win_rate;
+    double nodes_per_second;
+};
+
+// Result of MCTS::SearchAsync(). Get() returns the move the search played,
+// or rethrows what the search threw. Destroying a handle whose result was not
+// taken cancels the search and waits for it.
+template <typename Move>
+class SearchHandle {
+public:
+    SearchHandle(std::future<Move> result, std::atomic<bool>* cancelled) noexcept
+        : cancelled_(cancelled)
+        , result_(std::move(result)) {
+    }
+
+    SearchHandle(SearchHandle&&) noexcept = default;
+
+    SearchHandle& operator=(SearchHandle&& other) {
+        if (this != &other) {
+            if (result_.valid()) {
+                Cancel();
+                result_.wait();
+            }
+            cancelled_ = other.cancelled_;
+            result_ = std::move(other.result_);
+        }
+        return *this;
+    }
+
+    ~SearchHandle() {
+        if (result_.valid()) {
+            Cancel();
+            result_.wait();
+        }
+    }
+
+    // Stops the search, including the rollouts already running. Iterations
+    // that did not finish are dropped, and the best move found so far is
+    // played.
+    void Cancel() noexcept {
+        cancelled_->store(true, std::memory_order_relaxed);
+    }
+
+    // Returns true if the search finished before deadline.
+    [[nodiscard]] bool Wait(std::chrono::steady_clock::time_point deadline) const {
+        return result_.wait_until(deadline) == std::future_status::ready;
+    }
+
+    void Wait() const {
+        result_.wait();
+    }
+
+    Move Get() {
+        return result_.get();
+    }
+
+private:
+    std::atomic<bool>* cancelled_;
+    std::future<Move> result_;
+};
+
+}
@@ -0,0 +1,269 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+#include "mcts.h"
+
+namespace mcts {
+
+// Latency of the searches of one game, from Submit() until the move was
+// played.
+struct GameLatency {
+    GameLatency() noexcept
+        : searches(0)
+        , expired(0)
+        , last(0)
+        , max(0)
+        , total(0)
+        , total_wait(0) {
+    }
+
+    [[nodiscard]] milliseconds GetAverage() const noexcept {
+        return searches > 0 ? total / static_cast<int64_t>(searches) : milliseconds(0);
+    }
+
+    size_t searches;
+    // Searches stopped by their deadline before their iterations ran.
+    size_t expired;
+    milliseconds last;
+    milliseconds max;
+    milliseconds total;
+    // Time spent queued before the first slice ran.
+    milliseconds total_wait;
+};
+
+// Runs the searches of many engines, e.g. one per game, on one pair of
+// thread pools. Every select thread runs a dispatcher that takes the queued
+// search with the smallest virtual finish time and runs a slice of its
+// iterations through MCTS::Search(). A slice advances the finish time of its
+// search by slice size / weight, so under load every search gets select
+// threads in proportion to its weight (start-time fair queuing). A search
+// ends when its iterations ran or its deadline passed, and its engine then
+// plays the best move.
+//
+// An engine must outlive its search and must not be used by its owner or
+// submitted again until the future is ready.
+class SearchService {
+public:
+    static constexpr int32_t kDefaultSliceSize = 16;
+
+    explicit SearchService(size_t select_threads = std::thread::hardware_concurrency(),
+                           size_t rollout_threads = std::thread::hardware_concurrency())
+        : stopped_(false)
+        , slice_size_(kDefaultSliceSize)
+        , running_(0)
+        , virtual_time_(0)
+        , select_tp_(select_threads)
+        , rollout_tp_(rollout_threads) {
+        const auto dispatchers = (std::max)(select_tp_.GetThreadCount(), size_t(1));
+        dispatchers_ = mcts::ParallelFor(select_tp_, size_t(0), dispatchers, size_t(1), [this](size_t) {
+            Dispatch();
+        });
+    }
+
+    SearchService(const SearchService&) = delete;
+    SearchService& operator=(const SearchService&) = delete;
+
+    // Searches still queued fail with std::runtime_error.
+    ~SearchService() {
+        {
+            std::lock_guard guard{ mutex_ };
+            stopped_ = true;
+        }
+        wake_.notify_all();
+        for (auto& dispatcher : dispatchers_) {
+            dispatcher.wait();
+        }
+        for (auto& request : queue_) {
+            request->fail(std::make_exception_ptr(std::runtime_error("SearchService stopped")));
+        }
+    }
+
+    // Iterations a dispatcher runs before it picks the next search.
+    void SetSliceSize(int32_t iterations) noexcept {
+        std::lock_guard guard{ mutex_ };
+        slice_size_ = (std::max)(iterations, 1);
+    }
+
+    // Queues a search of engine for game_id. It runs up to iterations
+    // iterations and stops at deadline. weight is the share of the select
+    // threads the game gets relative to the other queued games.
+    template <typename Engine>
+    std::future<typename Engine::move_type> Submit(Engine& engine,
+                                                   uint64_t game_id,
+                                                   int32_t iterations,
+                                                   steady_clock::time_point deadline,
+                                                   double weight = 1.0) {
+        using move_type = typename Engine::move_type;
+        if (iterations <= 0 || weight <= 0) {
+            throw std::invalid_argument("SearchService needs positive iterations and weight");
+        }
+        auto promise = std::make_shared<std::promise<move_type>>();
+        auto result = promise->get_future();
+        auto request = std::make_unique<Request>();
+        request->game_id = game_id;
+        request->weight = weight;
+        request->remaining = iterations;
+        request->submitted = steady_clock::now();
+        request->deadline = deadline;
+        request->search = [&engine](ThreadPool& rollout_tp, int32_t slice, steady_clock::time_point slice_deadline) {
+            return engine.Search(rollout_tp, slice, slice_deadline);
+        };
+        request->play = [&engine, promise]() {
+            promise->set_value(engine.PlayBestMove());
+        };
+        request->fail = [promise](std::exception_ptr error) {
+            promise->set_exception(error);
+        };
+        {
+            std::lock_guard guard{ mutex_ };
+            if (stopped_) {
+                throw std::runtime_error("SearchService stopped");
+            }
+            request->finish = virtual_time_;
+            queue_.push_back(std::move(request));
+        }
+        wake_.notify_one();
+        return result;
+    }
+
+    [[nodiscard]] GameLatency GetLatency(uint64_t game_id) const {
+        std::lock_guard guard{ mutex_ };
+        const auto itr = latencies_.find(game_id);
+        return itr != latencies_.end() ? itr->second : GameLatency();
+    }
+
+    // Drops the latency of a finished game.
+    void RemoveGame(uint64_t game_id) {
+        std::lock_guard guard{ mutex_ };
+        latencies_.erase(game_id);
+    }
+
+    // Searches queued or running.
+    [[nodiscard]] size_t GetPendingCount() const {
+        std::lock_guard guard{ mutex_ };
+        return queue_.size() + running_;
+    }
+
+    [[nodiscard]] ThreadPool& GetRolloutPool() noexcept {
+        return rollout_tp_;
+    }
+
+private:
+    struct Request {
+        Request() noexcept
+            : game_id(0)
+            , weight(1.0)
+            , remaining(0)
+            , finish(0)
+            , started(false) {
+        }
+
+        uint64_t game_id;
+        double weight;
+        int32_t remaining;
+        // Virtual time at which the last slice of this search ends.
+        double finish;
+        bool started;
+        steady_clock::time_point submitted;
+        steady_clock::time_point deadline;
+        std::function<int32_t(ThreadPool&, int32_t, steady_clock::time_point)> search;
+        std::function<void()> play;
+        std::function<void(std::exception_ptr)> fail;
+    };
+
+    using RequestPtr = std::unique_ptr<Request>;
+
+    void Dispatch() {
+        std::unique_lock lock{ mutex_ };
+        for (;;) {
+            wake_.wait(lock, [this]() {
+                return stopped_ || !queue_.empty();
+            });
+            if (stopped_) {
+                return;
+            }
+            auto itr = std::min_element(queue_.begin(), queue_.end(), [](const RequestPtr& a, const RequestPtr& b) {
+                return a->finish < b->finish;
+            });
+            auto request = std::move(*itr);
+            queue_.erase(itr);
+            ++running_;
+            const auto now = steady_clock::now();
+            if (!request->started) {
+                request->started = true;
+                latencies_[request->game_id].total_wait += duration_cast<milliseconds>(now - request->submitted);
+            }
+            // The start of the slice becomes the virtual time, so a search
+            // queued later starts level with the others instead of ahead.
+            virtual_time_ = (std::max)(virtual_time_, request->finish);
+            const auto slice = (std::min)(slice_size_, request->remaining);
+            request->finish = virtual_time_ + slice / request->weight;
+            lock.unlock();
+
+            auto iterations = 0;
+            std::exception_ptr error;
+            if (now <= request->deadline) {
+                try {
+                    iterations = request->search(rollout_tp_, slice, request->deadline);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            request->remaining -= iterations;
+            const auto expired = steady_clock::now() > request->deadline;
+            if (error == nullptr && request->remaining > 0 && !expired) {
+                lock.lock();
+                --running_;
+                queue_.push_back(std::move(request));
+                wake_.notify_one();
+                continue;
+            }
+            if (error == nullptr) {
+                try {
+                    request->play();
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            if (error != nullptr) {
+                request->fail(error);
+            }
+
+            const auto latency = duration_cast<milliseconds>(steady_clock::now() - request->submitted);
+            lock.lock();
+            --running_;
+            auto& stats = latencies_[request->game_id];
+            ++stats.searches;
+            if (request->remaining > 0) {
+                ++stats.expired;
+            }
+            stats.last = latency;
+            stats.max = (std::max)(stats.max, latency);
+            stats.total += latency;
+        }
+    }
+
+    bool stopped_;
+    int32_t slice_size_;
+    size_t running_;
+    // Finish time of the last slice started; new searches start here.
+    double virtual_time_;
+    mutable FastMutex mutex_;
+    FastConditionVariable wake_;
+    std::vector<RequestPtr> queue_;
+    HashMap<uint64_t, GameLatency> latencies_;
+    ThreadPool select_tp_;
+    ThreadPool rollout_tp_;
+    std::vector<std::future<void>> dispatchers_;
+};
+
+}
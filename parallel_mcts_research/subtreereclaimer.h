@@ -0,0 +1,50 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <thread>
+#include <utility>
+
+#include "threadpool.h"
+#include "nodetree.h"
+
+namespace mcts {
+
+// Destroys abandoned subtrees on a background thread so that re-rooting the
+// tree after a move does not stall the engine.
+template <typename Tree>
+class SubtreeReclaimer {
+public:
+    explicit SubtreeReclaimer(Tree& tree)
+        : tree_(tree)
+        , thread_([this]() {
+            Job job;
+            while (jobs_.Dequeue(job)) {
+                tree_.DestroySubtree(job.first, job.second);
+            }
+        }) {
+    }
+
+    SubtreeReclaimer(const SubtreeReclaimer&) = delete;
+    SubtreeReclaimer& operator=(const SubtreeReclaimer&) = delete;
+
+    // Finishes every queued job before returning.
+    ~SubtreeReclaimer() {
+        jobs_.Done();
+        thread_.join();
+    }
+
+    // Queues the subtree of root without the subtree of keep.
+    void Reclaim(NodeIndex root, NodeIndex keep) {
+        jobs_.Enqueue(Job(root, keep));
+    }
+
+private:
+    using Job = std::pair<NodeIndex, NodeIndex>;
+
+    Tree& tree_;
+    TaskQueue<Job> jobs_;
+    std::thread thread_;
+};
+
+}
@@ -0,0 +1,260 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "ucbpolicy.h"
+
+// Checks RewardStats and UCB1TunedPolicy against a two-pass computation
+// of the mean and variance over the raw rewards, VisitTables against the
+// expressions it replaces, and the policies' SelectChild() against a scan
+// with their Evaluate(). Returns 1 on a mismatch.
+
+namespace {
+
+constexpr double kTolerance = 1e-9;
+
+int failures = 0;
+
+void Check(bool ok, const char* what, int trial) {
+	if (!ok) {
+		++failures;
+		std::cerr << "FAILED " << what << " (trial " << trial << ")" << std::endl;
+	}
+}
+
+bool Near(double a, double b) {
+	return std::fabs(a - b) <= kTolerance * (std::max)(1.0, std::fabs(b));
+}
+
+// Sum and sum of squared deviations from the mean of rewards[begin, end).
+void TwoPass(const std::vector<double>& rewards, size_t begin, size_t end, double& sum, double& deviations) {
+	sum = 0;
+	for (auto i = begin; i < end; ++i) {
+		sum += rewards[i];
+	}
+	const auto mean = end > begin ? sum / static_cast<double>(end - begin) : 0;
+	deviations = 0;
+	for (auto i = begin; i < end; ++i) {
+		deviations += (rewards[i] - mean) * (rewards[i] - mean);
+	}
+}
+
+// Win/draw/loss playouts, halves, and arbitrary real rewards.
+std::vector<double> MakeRewards(std::mt19937_64& rng, size_t count, int kind) {
+	std::vector<double> rewards(count);
+	std::uniform_real_distribution<double> real(-3.0, 5.0);
+	for (auto& reward : rewards) {
+		switch (kind) {
+		case 0:
+			reward = static_cast<double>(rng() % 2);
+			break;
+		case 1:
+			reward = 0.5 * static_cast<double>(rng() % 3);
+			break;
+		default:
+			reward = real(rng);
+			break;
+		}
+	}
+	return rewards;
+}
+
+mcts::RewardStats Collect(const std::vector<double>& rewards, size_t begin, size_t end) {
+	mcts::RewardStats stats;
+	for (auto i = begin; i < end; ++i) {
+		stats.Add(rewards[i]);
+	}
+	return stats;
+}
+
+void CheckStats(const mcts::RewardStats& stats, const std::vector<double>& rewards, size_t begin, size_t end, const char* what, int trial) {
+	double sum = 0;
+	double deviations = 0;
+	TwoPass(rewards, begin, end, sum, deviations);
+	const auto count = static_cast<int64_t>(end - begin);
+	Check(stats.GetCount() == count, what, trial);
+	Check(Near(stats.GetSum(), sum), what, trial);
+	Check(Near(stats.GetDeviations(), deviations), what, trial);
+	Check(Near(stats.GetVariance(), count > 0 ? deviations / static_cast<double>(count) : 0), what, trial);
+}
+
+void TestAdd(std::mt19937_64& rng, int trial) {
+	const auto rewards = MakeRewards(rng, 1 + rng() % 300, trial % 3);
+	CheckStats(Collect(rewards, 0, rewards.size()), rewards, 0, rewards.size(), "Add", trial);
+}
+
+// Splits the rewards at a random point, empty sides included, and merges
+// the parts both ways.
+void TestMerge(std::mt19937_64& rng, int trial) {
+	const auto rewards = MakeRewards(rng, rng() % 300, trial % 3);
+	const auto size = rewards.size();
+	const auto cut = trial % 5 == 0 ? 0 : trial % 5 == 1 ? size : rng() % (size + 1);
+	auto left = Collect(rewards, 0, cut);
+	const auto right = Collect(rewards, cut, size);
+	auto merged = right;
+	merged.Merge(left);
+	CheckStats(merged, rewards, 0, size, "Merge into right", trial);
+	left.Merge(right);
+	CheckStats(left, rewards, 0, size, "Merge into left", trial);
+}
+
+// Merges single-sample sets one by one, as a rollout of one playout does.
+void TestSingleSamples(std::mt19937_64& rng, int trial) {
+	const auto rewards = MakeRewards(rng, 1 + rng() % 100, trial % 3);
+	mcts::RewardStats stats;
+	for (auto reward : rewards) {
+		mcts::RewardStats single;
+		single.Add(reward);
+		Check(single.GetCount() == 1 && single.GetDeviations() == 0, "Single sample", trial);
+		stats.Merge(single);
+	}
+	CheckStats(stats, rewards, 0, rewards.size(), "Merge single samples", trial);
+}
+
+// Feeds the policy rollouts of 1 to 8 playouts and compares its value with
+// the formula evaluated on the two-pass variance.
+void TestTunedPolicy(std::mt19937_64& rng, int trial) {
+	const auto rewards = MakeRewards(rng, 1 + rng() % 300, trial % 3);
+	mcts::UCB1TunedPolicy policy;
+	for (size_t i = 0; i < rewards.size();) {
+		const auto end = (std::min)(rewards.size(), i + 1 + rng() % 8);
+		policy.Update(Collect(rewards, i, end));
+		i = end;
+	}
+	double sum = 0;
+	double deviations = 0;
+	TwoPass(rewards, 0, rewards.size(), sum, deviations);
+	const auto visits = static_cast<double>(rewards.size());
+	Check(policy.GetVisits() == static_cast<int64_t>(rewards.size()), "Tuned visits", trial);
+	Check(Near(policy.GetScore(), sum), "Tuned score", trial);
+	Check(Near(policy.GetDeviations(), deviations), "Tuned deviations", trial);
+
+	const auto parent_visits = static_cast<int64_t>(rewards.size() + rng() % 1000);
+	const auto log_parent = std::log(static_cast<double>(parent_visits));
+	// Auer et al.: mean + sqrt(ln n / n_j * min(1/4, V_j)), with
+	// V_j = variance + sqrt(2 ln n / n_j).
+	const auto V = deviations / visits + std::sqrt(2 * log_parent / visits);
+	const auto expected = sum / visits + std::sqrt(log_parent / visits * (std::min)(0.25, V));
+	const auto& tables = mcts::VisitTables::Get(1 + trial % 3);
+	const auto parent_term = mcts::UCB1TunedPolicy::GetParentTerm(tables, parent_visits);
+	Check(Near(policy(tables, parent_term), expected), "Tuned Evaluate", trial);
+}
+
+// Table lookups return what the expressions give, for multiples of the
+// unit in the tables, beyond them and between them.
+void TestVisitTables(std::mt19937_64& rng, int trial) {
+	const auto unit = static_cast<int64_t>(1 + rng() % 20000);
+	const auto& tables = mcts::VisitTables::Get(unit);
+	Check(&tables == &mcts::VisitTables::Get(unit), "VisitTables shared", trial);
+	for (auto i = 0; i < 50; ++i) {
+		auto visits = unit * static_cast<int64_t>(rng() % (2 * mcts::VisitTables::kSize));
+		if (i % 3 == 0) {
+			visits += static_cast<int64_t>(rng() % unit);
+		}
+		Check(tables.Log(visits) == std::log(static_cast<double>(visits)), "VisitTables Log", trial);
+		Check(tables.InvSqrt(visits) == 1.0 / std::sqrt(static_cast<double>(visits)), "VisitTables InvSqrt", trial);
+	}
+}
+
+// Index of the lowest value, the first one on ties, scored one child at a
+// time as the per-node layouts do.
+template <typename Policy>
+uint32_t ScanChildren(const mcts::VisitTables& tables, const std::vector<double>& scores, const std::vector<int64_t>& visits, const std::vector<double>& deviations, int64_t parent_visits) {
+	const auto parent_term = Policy::GetParentTerm(tables, parent_visits);
+	uint32_t best = 0;
+	double best_ucb = 0;
+	for (uint32_t i = 0; i < scores.size(); ++i) {
+		double ucb = 0;
+		if constexpr (Policy::kTracksSquares) {
+			ucb = Policy::Evaluate(tables, scores[i], visits[i], deviations[i], parent_term);
+		}
+		else {
+			ucb = Policy::Evaluate(tables, scores[i], visits[i], parent_term);
+		}
+		if (i == 0 || best_ucb > ucb) {
+			best_ucb = ucb;
+			best = i;
+		}
+	}
+	return best;
+}
+
+// Random packed columns with ties and children without visits: the first,
+// the last, one of the first four or all of them. SelectChild() uses the
+// AVX2 kernel from four children on when the CPU has it.
+template <typename Policy>
+void TestSelectChild(std::mt19937_64& rng, int trial, const char* what) {
+	const auto size = static_cast<uint32_t>(1 + rng() % 40);
+	std::vector<double> scores(size);
+	std::vector<int64_t> visits(size);
+	std::vector<double> deviations(size);
+	int64_t parent_visits = 1;
+	for (uint32_t i = 0; i < size; ++i) {
+		visits[i] = 20 * static_cast<int64_t>(1 + rng() % (trial % 2 ? 5 : 500));
+		scores[i] = 0.5 * static_cast<double>(rng() % (2 * visits[i] + 1));
+		deviations[i] = scores[i] * 0.3;
+		parent_visits += visits[i];
+	}
+	if (trial % 4 == 0 && size > 1) {
+		visits[size - 1] = visits[0];
+		scores[size - 1] = scores[0];
+		deviations[size - 1] = deviations[0];
+	}
+	// An abandoned iteration leaves its child without visits or rewards.
+	const auto clear = [&](uint32_t i) {
+		visits[i] = 0;
+		scores[i] = 0;
+		deviations[i] = 0;
+	};
+	switch (trial % 5) {
+	case 0:
+		clear(0);
+		break;
+	case 1:
+		clear(size - 1);
+		break;
+	case 2:
+		// Within the first group, so an unvisited child opens a kernel lane.
+		clear(static_cast<uint32_t>(rng() % (std::min)(size, mcts::ucb_kernel::kLanes)));
+		break;
+	case 3:
+		for (uint32_t i = 0; i < size; ++i) {
+			clear(i);
+		}
+		break;
+	default:
+		break;
+	}
+	const auto& tables = mcts::VisitTables::Get(20);
+	const auto expected = ScanChildren<Policy>(tables, scores, visits, deviations, parent_visits);
+	Check(Policy::SelectChild(tables, scores.data(), visits.data(), deviations.data(), size, parent_visits) == expected, what, trial);
+	if (visits[expected] != 0) {
+		Check(std::find(visits.begin(), visits.end(), 0) == visits.end(), "Unvisited child picked first", trial);
+	}
+}
+
+}
+
+int main() {
+	std::mt19937_64 rng(7);
+	for (auto trial = 0; trial < 2000; ++trial) {
+		TestAdd(rng, trial);
+		TestMerge(rng, trial);
+		TestSingleSamples(rng, trial);
+		TestTunedPolicy(rng, trial);
+		TestVisitTables(rng, trial);
+		TestSelectChild<mcts::DefaultUCB1Policy>(rng, trial, "UCB1 SelectChild");
+		TestSelectChild<mcts::UCB1TunedPolicy>(rng, trial, "Tuned SelectChild");
+	}
+	if (failures != 0) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All checks passed" << std::endl;
+	return 0;
+}
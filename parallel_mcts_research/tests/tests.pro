@@ -0,0 +1,14 @@
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle
+CONFIG -= qt
+
+TARGET = rewardstats_test
+
+SOURCES += rewardstats_test.cpp
+
+INCLUDEPATH += ..
+
+HEADERS += \
+    ../ucbkernel.h \
+    ../ucbpolicy.h
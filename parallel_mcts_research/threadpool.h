@@ -266,6 +266,10 @@ public:
         task_queues_[i % task_queues_.size()]->Enqueue(task);
     }
 
+    [[nodiscard]] size_t GetThreadCount() const noexcept {
+        return max_thread_;
+    }
+
     void Destory() {
         is_stopped_ = true;
 
@@ -314,7 +318,7 @@ private:
     }
 
     std::atomic<bool> is_stopped_;
-    size_t index_;
+    std::atomic<size_t> index_;
     size_t max_thread_;
     std::vector<std::thread> threads_;
     std::vector<std::unique_ptr<Queue<TaskType>>> task_queues_;
@@ -329,6 +333,10 @@ public:
     template <class F, class... Args>
     std::future<typename std::result_of<F(Args ...)>::type> Spawn(F&& f, Args&& ... args);
 
+    [[nodiscard]] size_t GetThreadCount() const noexcept {
+        return scheduler_.GetThreadCount();
+    }
+
 private:
     TaskScheduler<Task> scheduler_;
 };
@@ -0,0 +1,201 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace mcts {
+
+enum class StopReason {
+    kNone,
+    // evaluate_count iterations ran.
+    kBudget,
+    // search_time ran out.
+    kDeadline,
+    // No other child can overtake the best one in the remaining budget.
+    kDecided,
+    // The owner of the search cancelled it.
+    kCancelled,
+};
+
+inline const char* GetStopReasonName(StopReason reason) noexcept {
+    switch (reason) {
+    case StopReason::kBudget:
+        return "budget";
+    case StopReason::kDeadline:
+        return "deadline";
+    case StopReason::kDecided:
+        return "decided";
+    case StopReason::kCancelled:
+        return "cancelled";
+    default:
+        return "none";
+    }
+}
+
+struct SearchReport {
+    SearchReport() noexcept
+        : reason(StopReason::kNone)
+        , iterations(0)
+        , elapsed(0)
+        , extended(false)
+        , best_changes(0) {
+    }
+
+    StopReason reason;
+    int32_t iterations;
+    std::chrono::milliseconds elapsed;
+    // The budget was extended because the best move kept changing.
+    bool extended;
+    // Checks that found a different best child than the check before.
+    int32_t best_changes;
+};
+
+// Hands out the iterations of one search to the worker loops. Stops at the
+// iteration budget or the deadline, or as soon as the engine reports that
+// the best move is decided. When the budget or the deadline runs out while
+// the best move changed at the last check, both are extended once by
+// extension times their original size. Raising *cancelled stops the search
+// at the next claim.
+class TimeManager {
+public:
+    TimeManager(int32_t iterations,
+                std::chrono::milliseconds search_time,
+                double extension,
+                const std::atomic<bool>* cancelled = nullptr) noexcept
+        : cancelled_(cancelled)
+        , start_(std::chrono::steady_clock::now())
+        , extra_iterations_(static_cast<int32_t>(iterations * extension))
+        , extra_time_(std::chrono::duration_cast<std::chrono::nanoseconds>(search_time * extension).count())
+        , remaining_(iterations)
+        , started_(0)
+        , deadline_(std::chrono::duration_cast<std::chrono::nanoseconds>(search_time).count())
+        , stopped_(false)
+        , extended_(false)
+        , unstable_(false)
+        , reason_(StopReason::kNone)
+        , best_changes_(0)
+        , last_best_(-1)
+        , next_progress_(0) {
+    }
+
+    TimeManager(const TimeManager&) = delete;
+    TimeManager& operator=(const TimeManager&) = delete;
+
+    // Claims the next iteration and stores its number in iteration. Returns
+    // false once the search should stop.
+    bool Next(int32_t& iteration) noexcept {
+        for (;;) {
+            if (stopped_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            if (cancelled_ != nullptr && cancelled_->load(std::memory_order_relaxed)) {
+                Stop(StopReason::kCancelled);
+                continue;
+            }
+            if (GetElapsed().count() > deadline_.load(std::memory_order_relaxed)) {
+                if (!TryExtend()) {
+                    Stop(StopReason::kDeadline);
+                }
+                continue;
+            }
+            if (remaining_.fetch_sub(1, std::memory_order_relaxed) > 0) {
+                iteration = started_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            remaining_.fetch_add(1, std::memory_order_relaxed);
+            if (!TryExtend()) {
+                Stop(StopReason::kBudget);
+            }
+        }
+    }
+
+    // Iterations the search can still run, limited by the budget and by the
+    // time left at the rate seen so far.
+    [[nodiscard]] int64_t GetRemainingIterations() const noexcept {
+        const int64_t budget = (std::max)(remaining_.load(std::memory_order_relaxed), 0);
+        const auto elapsed = GetElapsed().count();
+        const auto started = started_.load(std::memory_order_relaxed);
+        if (elapsed <= 0 || started == 0) {
+            return budget;
+        }
+        const auto time_left = (std::max)(deadline_.load(std::memory_order_relaxed) - elapsed, int64_t(0));
+        const auto by_time = static_cast<int64_t>(static_cast<double>(time_left) * started / static_cast<double>(elapsed));
+        return (std::min)(budget, by_time);
+    }
+
+    // Records the best child found by a check, and whether no other child
+    // can overtake it any more.
+    void Report(int64_t best, bool decided) noexcept {
+        const auto last_best = last_best_.exchange(best, std::memory_order_relaxed);
+        const auto changed = last_best != -1 && last_best != best;
+        if (changed) {
+            best_changes_.fetch_add(1, std::memory_order_relaxed);
+        }
+        unstable_.store(changed, std::memory_order_relaxed);
+        if (decided) {
+            Stop(StopReason::kDecided);
+        }
+    }
+
+    // Returns true for one caller once every interval.
+    [[nodiscard]] bool IsProgressDue(std::chrono::milliseconds interval) noexcept {
+        const auto elapsed = GetElapsed().count();
+        auto next = next_progress_.load(std::memory_order_relaxed);
+        if (elapsed < next) {
+            return false;
+        }
+        const auto following = elapsed + std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count();
+        return next_progress_.compare_exchange_strong(next, following, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] SearchReport GetReport() const noexcept {
+        SearchReport report;
+        report.reason = reason_.load(std::memory_order_acquire);
+        report.iterations = started_.load(std::memory_order_relaxed);
+        report.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::nanoseconds(GetElapsed()));
+        report.extended = extended_.load(std::memory_order_relaxed);
+        report.best_changes = best_changes_.load(std::memory_order_relaxed);
+        return report;
+    }
+
+private:
+    std::chrono::nanoseconds GetElapsed() const noexcept {
+        return std::chrono::steady_clock::now() - start_;
+    }
+
+    bool TryExtend() noexcept {
+        if (!unstable_.load(std::memory_order_relaxed) || extended_.exchange(true, std::memory_order_relaxed)) {
+            return false;
+        }
+        remaining_.fetch_add(extra_iterations_, std::memory_order_relaxed);
+        deadline_.fetch_add(extra_time_, std::memory_order_relaxed);
+        return true;
+    }
+
+    void Stop(StopReason reason) noexcept {
+        auto expected = StopReason::kNone;
+        reason_.compare_exchange_strong(expected, reason, std::memory_order_relaxed);
+        stopped_.store(true, std::memory_order_release);
+    }
+
+    const std::atomic<bool>* cancelled_;
+    const std::chrono::steady_clock::time_point start_;
+    const int32_t extra_iterations_;
+    const int64_t extra_time_;
+    std::atomic<int32_t> remaining_;
+    std::atomic<int32_t> started_;
+    std::atomic<int64_t> deadline_;
+    std::atomic<bool> stopped_;
+    std::atomic<bool> extended_;
+    std::atomic<bool> unstable_;
+    std::atomic<StopReason> reason_;
+    std::atomic<int32_t> best_changes_;
+    std::atomic<int64_t> last_best_;
+    std::atomic<int64_t> next_progress_;
+};
+
+}
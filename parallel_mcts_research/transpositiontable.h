@@ -0,0 +1,109 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "tweakme.h"
+
+namespace mcts {
+
+// Concurrent map from a position hash key to a shared Record. The table is
+// split into shards with one lock each, and entries never move, so a pointer
+// returned by Acquire() stays valid until its last reference is released and
+// Purge() runs.
+template <typename Record>
+class TranspositionTable {
+public:
+    static constexpr size_t kShards = 64;
+
+    struct Entry {
+        Entry() noexcept
+            : key(0)
+            , references(0) {
+        }
+
+        uint64_t key;
+        std::atomic<uint32_t> references;
+        Record record;
+    };
+
+    TranspositionTable() = default;
+
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+    // Returns the entry of key, creating a fresh record the first time, and
+    // takes a reference to it.
+    Entry* Acquire(uint64_t key) {
+        auto& shard = shards_[key % kShards];
+        std::lock_guard guard{ shard.mutex };
+        auto itr = shard.entries.find(key);
+        if (itr != shard.entries.end()) {
+            itr->second->references.fetch_add(1, std::memory_order_relaxed);
+            return itr->second;
+        }
+        Entry* entry = nullptr;
+        if (!shard.free_entries.empty()) {
+            entry = shard.free_entries.back();
+            shard.free_entries.pop_back();
+            entry->record = Record();
+        }
+        else {
+            entry = &shard.storage.emplace_back();
+        }
+        entry->key = key;
+        entry->references.store(1, std::memory_order_relaxed);
+        shard.entries.emplace(key, entry);
+        return entry;
+    }
+
+    static void Release(Entry* entry) noexcept {
+        entry->references.fetch_sub(1, std::memory_order_release);
+    }
+
+    // Recycles every entry without references. No thread may call Acquire()
+    // while this runs.
+    size_t Purge() {
+        size_t purged = 0;
+        for (auto& shard : shards_) {
+            std::lock_guard guard{ shard.mutex };
+            for (auto itr = shard.entries.begin(); itr != shard.entries.end();) {
+                if (itr->second->references.load(std::memory_order_acquire) == 0) {
+                    shard.free_entries.push_back(itr->second);
+                    itr = shard.entries.erase(itr);
+                    ++purged;
+                }
+                else {
+                    ++itr;
+                }
+            }
+        }
+        return purged;
+    }
+
+    [[nodiscard]] size_t GetSize() const {
+        size_t size = 0;
+        for (auto& shard : shards_) {
+            std::lock_guard guard{ shard.mutex };
+            size += shard.entries.size();
+        }
+        return size;
+    }
+
+private:
+    struct Shard {
+        mutable FastMutex mutex;
+        HashMap<uint64_t, Entry*> entries;
+        std::deque<Entry> storage;
+        std::vector<Entry*> free_entries;
+    };
+
+    Shard shards_[kShards];
+};
+
+}
@@ -15,10 +15,26 @@ using HashSet = std::unordered_set<T>;
 
 template <typename Key, typename Value>
 using HashMap = std::unordered_map<Key, Value>;
+
+// Heap bytes held by a HashSet: the bucket array and one node per element.
+template <typename T>
+size_t GetHashSetBytes(const HashSet<T>& set) noexcept {
+    return set.bucket_count() * sizeof(void*) + set.size() * (sizeof(T) + 2 * sizeof(void*));
+}
 #else
 template <typename T>
 using HashSet = robin_hood::unordered_set<T>;
 
 template <typename Key, typename Value>
 using HashMap = robin_hood::unordered_map<Key, Value>;
+
+// Heap bytes held by a HashSet: the slots and their info bytes. An empty
+// set that never grew holds none.
+template <typename T>
+size_t GetHashSetBytes(const HashSet<T>& set) noexcept {
+    if (set.mask() == 0) {
+        return 0;
+    }
+    return set.calcNumBytesTotal(set.calcNumElementsWithBuffer(set.mask() + 1));
+}
 #endif
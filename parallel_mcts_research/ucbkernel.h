@@ -0,0 +1,206 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define MCTS_UCB_KERNEL_AVX2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(MCTS_UCB_KERNEL_AVX2) && defined(__GNUC__)
+#define MCTS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MCTS_TARGET_AVX2
+#endif
+
+namespace mcts {
+
+// Vectorized child selection over packed statistics columns, used by the
+// UCB1 policies when the children of a node are stored contiguously
+// (PackedStats): scores, visits and, for UCB1-Tuned, the squared deviations
+// of the rewards. A kernel scores four children per step and returns the
+// index of the lowest value, the child GetBestUCBChild() picks, taking the
+// first one on ties. The parent term comes from the policy; the operations
+// and their order match the scalar formulas, whose 1 / sqrt(visits) table
+// holds the same values, so both pick the same child. A child without visits
+// scores -infinity in both. The kernels are compiled for AVX2 whatever the
+// build flags and only called when the CPU has it.
+namespace ucb_kernel {
+
+// Children the kernels need at least; smaller nodes are scored one by one.
+constexpr uint32_t kLanes = 4;
+
+inline bool HasAVX2() noexcept {
+#if !defined(MCTS_UCB_KERNEL_AVX2)
+    return false;
+#elif defined(__GNUC__)
+    static const bool supported = __builtin_cpu_supports("avx2") != 0;
+    return supported;
+#else
+    static const bool supported = []() {
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        __cpuid(info, 1);
+        constexpr int kOSXSave = 1 << 27;
+        constexpr int kAVX = 1 << 28;
+        if ((info[2] & kOSXSave) == 0 || (info[2] & kAVX) == 0 || (_xgetbv(0) & 6) != 6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+    return supported;
+#endif
+}
+
+#ifdef MCTS_UCB_KERNEL_AVX2
+
+namespace detail {
+
+// Visit counts below 2^52 converted exactly, which AVX2 has no instruction
+// for: the count becomes the mantissa of 2^52 + count.
+MCTS_TARGET_AVX2 inline __m256d LoadVisits(const int64_t* visits) noexcept {
+    const auto magic = _mm256_set1_pd(4503599627370496.0);
+    const auto bits = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(visits));
+    return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(bits, _mm256_castpd_si256(magic))), magic);
+}
+
+// The last, partial group of children, padded with copies of the last child
+// so that the padding never wins over it.
+template <typename T>
+void LoadTail(const T* column, uint32_t first, uint32_t size, T (&lanes)[kLanes]) noexcept {
+    for (uint32_t lane = 0; lane < kLanes; ++lane) {
+        lanes[lane] = column[(std::min)(first + lane, size - 1)];
+    }
+}
+
+// Keeps the lowest value seen in every lane and the index it came from.
+struct Argmin {
+    MCTS_TARGET_AVX2 void Init(__m256d values) noexcept {
+        best = values;
+        best_index = _mm256_set_pd(3, 2, 1, 0);
+    }
+
+    MCTS_TARGET_AVX2 void Add(__m256d values, uint32_t first) noexcept {
+        const auto index = _mm256_add_pd(_mm256_set1_pd(first), _mm256_set_pd(3, 2, 1, 0));
+        const auto lower = _mm256_cmp_pd(values, best, _CMP_LT_OQ);
+        best = _mm256_blendv_pd(best, values, lower);
+        best_index = _mm256_blendv_pd(best_index, index, lower);
+    }
+
+    MCTS_TARGET_AVX2 uint32_t Get() const noexcept {
+        alignas(32) double values[kLanes];
+        alignas(32) double indexes[kLanes];
+        _mm256_store_pd(values, best);
+        _mm256_store_pd(indexes, best_index);
+        auto lane = 0;
+        for (auto i = 1; i < static_cast<int>(kLanes); ++i) {
+            if (values[i] < values[lane] || (values[i] == values[lane] && indexes[i] < indexes[lane])) {
+                lane = i;
+            }
+        }
+        return static_cast<uint32_t>(indexes[lane]);
+    }
+
+    __m256d best;
+    __m256d best_index;
+};
+
+MCTS_TARGET_AVX2 inline __m256d InvSqrt(__m256d visits) noexcept {
+    return _mm256_div_pd(_mm256_set1_pd(1.0), _mm256_sqrt_pd(visits));
+}
+
+// -infinity instead of the NaN or infinity the formulas give children
+// without visits.
+MCTS_TARGET_AVX2 inline __m256d ScoreUnvisited(__m256d values, __m256d visits) noexcept {
+    const auto unvisited = _mm256_cmp_pd(visits, _mm256_setzero_pd(), _CMP_EQ_OQ);
+    return _mm256_blendv_pd(values, _mm256_set1_pd(-std::numeric_limits<double>::infinity()), unvisited);
+}
+
+// score / visits + parent_term / sqrt(visits)
+MCTS_TARGET_AVX2 inline __m256d EvaluateUCB1(__m256d score, __m256d visits, __m256d parent_term) noexcept {
+    const auto ucb = _mm256_add_pd(_mm256_div_pd(score, visits), _mm256_mul_pd(parent_term, InvSqrt(visits)));
+    return ScoreUnvisited(ucb, visits);
+}
+
+// score / visits + parent_term / sqrt(visits) * sqrt(min(V, max_variance)),
+// with V = deviations / visits + bound_term / sqrt(visits)
+MCTS_TARGET_AVX2 inline __m256d EvaluateUCB1Tuned(__m256d score, __m256d visits, __m256d deviations, __m256d parent_term, __m256d bound_term, __m256d max_variance) noexcept {
+    const auto inv_sqrt_visits = InvSqrt(visits);
+    const auto variance = _mm256_add_pd(_mm256_div_pd(deviations, visits), _mm256_mul_pd(bound_term, inv_sqrt_visits));
+    const auto exploration = _mm256_mul_pd(parent_term, inv_sqrt_visits);
+    const auto ucb = _mm256_add_pd(_mm256_div_pd(score, visits), _mm256_mul_pd(exploration, _mm256_sqrt_pd(_mm256_min_pd(variance, max_variance))));
+    return ScoreUnvisited(ucb, visits);
+}
+
+}
+
+// DefaultUCB1Policy over size >= kLanes children, with its parent term.
+MCTS_TARGET_AVX2 inline uint32_t SelectUCB1(const double* scores, const int64_t* visits, uint32_t size, double parent_term) noexcept {
+    const auto parent_lanes = _mm256_set1_pd(parent_term);
+    detail::Argmin argmin;
+    argmin.Init(detail::EvaluateUCB1(_mm256_loadu_pd(scores), detail::LoadVisits(visits), parent_lanes));
+    uint32_t i = kLanes;
+    for (; i + kLanes <= size; i += kLanes) {
+        argmin.Add(detail::EvaluateUCB1(_mm256_loadu_pd(scores + i), detail::LoadVisits(visits + i), parent_lanes), i);
+    }
+    if (i < size) {
+        double tail_scores[kLanes];
+        int64_t tail_visits[kLanes];
+        detail::LoadTail(scores, i, size, tail_scores);
+        detail::LoadTail(visits, i, size, tail_visits);
+        argmin.Add(detail::EvaluateUCB1(_mm256_loadu_pd(tail_scores), detail::LoadVisits(tail_visits), parent_lanes), i);
+    }
+    return (std::min)(argmin.Get(), size - 1);
+}
+
+// UCB1TunedPolicy over size >= kLanes children, with its parent term. The
+// variance bound uses sqrt2 times the parent term.
+MCTS_TARGET_AVX2 inline uint32_t SelectUCB1Tuned(const double* scores, const int64_t* visits, const double* deviations, uint32_t size, double parent_term, double sqrt2, double max_variance) noexcept {
+    const auto parent_lanes = _mm256_set1_pd(parent_term);
+    const auto bound_lanes = _mm256_set1_pd(sqrt2 * parent_term);
+    const auto max_variance_lanes = _mm256_set1_pd(max_variance);
+    detail::Argmin argmin;
+    argmin.Init(detail::EvaluateUCB1Tuned(_mm256_loadu_pd(scores), detail::LoadVisits(visits), _mm256_loadu_pd(deviations), parent_lanes, bound_lanes, max_variance_lanes));
+    uint32_t i = kLanes;
+    for (; i + kLanes <= size; i += kLanes) {
+        argmin.Add(detail::EvaluateUCB1Tuned(_mm256_loadu_pd(scores + i), detail::LoadVisits(visits + i), _mm256_loadu_pd(deviations + i), parent_lanes, bound_lanes, max_variance_lanes), i);
+    }
+    if (i < size) {
+        double tail_scores[kLanes];
+        int64_t tail_visits[kLanes];
+        double tail_deviations[kLanes];
+        detail::LoadTail(scores, i, size, tail_scores);
+        detail::LoadTail(visits, i, size, tail_visits);
+        detail::LoadTail(deviations, i, size, tail_deviations);
+        argmin.Add(detail::EvaluateUCB1Tuned(_mm256_loadu_pd(tail_scores), detail::LoadVisits(tail_visits), _mm256_loadu_pd(tail_deviations), parent_lanes, bound_lanes, max_variance_lanes), i);
+    }
+    return (std::min)(argmin.Get(), size - 1);
+}
+
+#else
+
+// Never called: HasAVX2() is false.
+inline uint32_t SelectUCB1(const double*, const int64_t*, uint32_t, double) noexcept {
+    return 0;
+}
+
+inline uint32_t SelectUCB1Tuned(const double*, const int64_t*, const double*, uint32_t, double, double, double) noexcept {
+    return 0;
+}
+
+#endif
+
+}
+
+}
@@ -5,12 +5,157 @@
 #include <cstdint>
 #include <algorithm>
 #include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ucbkernel.h"
 
 namespace mcts {
 
+// log(n) and 1 / sqrt(n) for the visit counts of most nodes, computed once
+// per visit unit. Every backpropagation adds the rollouts of one iteration,
+// so the tables hold the multiples of that unit up to kSize iterations.
+// Other counts are computed on the spot with the same expressions, so a
+// lookup returns the same value as the computation it replaces.
+class VisitTables {
+public:
+    static constexpr int64_t kSize = 1 << 14;
+
+    // The tables for visits counted in multiples of unit, shared by every
+    // engine with that unit and built by the first one.
+    static const VisitTables& Get(int64_t unit) {
+        static std::mutex mutex;
+        static std::vector<std::unique_ptr<VisitTables>> tables;
+        unit = (std::max)(unit, int64_t(1));
+        std::lock_guard guard{ mutex };
+        for (const auto& table : tables) {
+            if (table->unit_ == unit) {
+                return *table;
+            }
+        }
+        tables.push_back(std::unique_ptr<VisitTables>(new VisitTables(unit)));
+        return *tables.back();
+    }
+
+    [[nodiscard]] double Log(int64_t visits) const noexcept {
+        const auto index = GetIndex(visits);
+        return index < kSize ? log_[index] : std::log(static_cast<double>(visits));
+    }
+
+    [[nodiscard]] double InvSqrt(int64_t visits) const noexcept {
+        const auto index = GetIndex(visits);
+        return index < kSize ? inv_sqrt_[index] : 1.0 / std::sqrt(static_cast<double>(visits));
+    }
+
+private:
+    explicit VisitTables(int64_t unit)
+        : unit_(unit)
+        , inv_unit_(1.0 / static_cast<double>(unit))
+        , log_(kSize)
+        , inv_sqrt_(kSize) {
+        for (int64_t i = 0; i < kSize; ++i) {
+            log_[i] = std::log(static_cast<double>(i * unit));
+            inv_sqrt_[i] = 1.0 / std::sqrt(static_cast<double>(i * unit));
+        }
+    }
+
+    // visits / unit_ if the tables hold visits, kSize otherwise. Checked
+    // with a multiplication, which is cheaper than a remainder.
+    int64_t GetIndex(int64_t visits) const noexcept {
+        const auto index = static_cast<int64_t>(static_cast<double>(visits) * inv_unit_ + 0.5);
+        return index < kSize && index * unit_ == visits ? index : kSize;
+    }
+
+    int64_t unit_;
+    double inv_unit_;
+    std::vector<double> log_;
+    std::vector<double> inv_sqrt_;
+};
+
+// Count, sum and sum of squared deviations from the mean (M2) of a set of
+// playout rewards, kept with Welford's update. Two sets of different
+// playouts merge exactly (Chan et al.), so the rewards of one rollout, of a
+// node and of root-parallel workers combine in any order.
+class RewardStats {
+public:
+    RewardStats() noexcept
+        : count_(0)
+        , sum_(0)
+        , deviations_(0) {
+    }
+
+    RewardStats(int64_t count, double sum, double deviations) noexcept
+        : count_(count)
+        , sum_(sum)
+        , deviations_(deviations) {
+    }
+
+    void Add(double reward) noexcept {
+        const auto delta = reward - GetMean();
+        ++count_;
+        sum_ += reward;
+        deviations_ += delta * (reward - GetMean());
+    }
+
+    void Merge(const RewardStats& other) noexcept {
+        Merge(sum_, count_, deviations_, other);
+    }
+
+    // Merges other into the set kept in sum, count and deviations.
+    static void Merge(double& sum, int64_t& count, double& deviations, const RewardStats& other) noexcept {
+        if (count > 0 && other.count_ > 0) {
+            const auto delta = other.GetMean() - sum / static_cast<double>(count);
+            const auto weight = static_cast<double>(count) * static_cast<double>(other.count_) / static_cast<double>(count + other.count_);
+            deviations += delta * delta * weight;
+        }
+        deviations += other.deviations_;
+        sum += other.sum_;
+        count += other.count_;
+    }
+
+    [[nodiscard]] int64_t GetCount() const noexcept {
+        return count_;
+    }
+
+    [[nodiscard]] double GetSum() const noexcept {
+        return sum_;
+    }
+
+    [[nodiscard]] double GetMean() const noexcept {
+        return count_ > 0 ? sum_ / static_cast<double>(count_) : 0;
+    }
+
+    [[nodiscard]] double GetDeviations() const noexcept {
+        return deviations_;
+    }
+
+    // Population variance of the rewards.
+    [[nodiscard]] double GetVariance() const noexcept {
+        return count_ > 0 ? deviations_ / static_cast<double>(count_) : 0;
+    }
+
+private:
+    int64_t count_;
+    double sum_;
+    double deviations_;
+};
+
+// Each policy keeps its statistics in a per-node object, and also exposes
+// the update and scoring formulas as static functions over raw values so the
+// packed statistics layout can share them. The part of the score that only
+// depends on the parent's visits comes from GetParentTerm(), once per
+// selection step, and is passed to Evaluate() for every child. Both take the
+// VisitTables of the engine's visit unit.
+// SelectChild() scores a whole packed column of children, with the AVX2
+// kernels of ucbkernel.h when the CPU has them.
+
 // Upper Confidence Bounds
 class DefaultUCB1Policy {
 public:
+    static constexpr bool kTracksSquares = false;
+
     DefaultUCB1Policy() noexcept
         : score_(0)
         , visits_(0) {
@@ -24,33 +169,87 @@ public:
         return visits_;
     }
 
-    void Update(double score, int32_t visits) noexcept {
-        score_ += score;
-		visits_ += visits;
+    void Update(const RewardStats& rewards) noexcept {
+        Accumulate(score_, visits_, rewards);
     }
 
-    double operator()(int64_t total_visits) const {
-    	if (total_visits == 0) {
-            return (std::numeric_limits<double>::max)();
-    	}
-        return (score_ / static_cast<double>(visits_)
-                + DefaultConstant() * std::sqrt(std::log(total_visits) / static_cast<double>(visits_)));
+    // Counts visits still being played out as wins, like the virtual loss of
+    // AtomicStats; a negative count takes them back.
+    void AddVirtualVisits(int32_t visits) noexcept {
+        score_ += visits;
+        visits_ += visits;
     }
+
+    double operator()(const VisitTables& tables, double parent_term) const {
+        return Evaluate(tables, score_, visits_, parent_term);
+    }
+
+    static void Accumulate(double& score_sum, int64_t& visits_sum, const RewardStats& rewards) noexcept {
+        score_sum += rewards.GetSum();
+        visits_sum += rewards.GetCount();
+    }
+
+    // constant * sqrt(log(total_visits)). Infinite before the first visit,
+    // so that every child scores the same.
+    static double GetParentTerm(const VisitTables& tables, int64_t total_visits) noexcept {
+        if (total_visits == 0) {
+            return std::numeric_limits<double>::infinity();
+        }
+        return DefaultConstant() * std::sqrt(tables.Log(total_visits));
+    }
+
+    // score / visits + constant * sqrt(log(total_visits) / visits), or
+    // -infinity without visits, e.g. after an abandoned iteration, so that
+    // the child is picked first.
+    static double Evaluate(const VisitTables& tables, double score, int64_t visits, double parent_term) noexcept {
+        if (visits == 0) {
+            return -std::numeric_limits<double>::infinity();
+        }
+        return score / static_cast<double>(visits) + parent_term * tables.InvSqrt(visits);
+    }
+
+    // Index of the lowest value among size children, the first one on ties.
+    static uint32_t SelectChild(const VisitTables& tables, const double* scores, const int64_t* visits, const double*, uint32_t size, int64_t total_visits) noexcept {
+        // Every child scores the same.
+        if (total_visits == 0) {
+            return 0;
+        }
+        if (size >= ucb_kernel::kLanes && ucb_kernel::HasAVX2()) {
+            return ucb_kernel::SelectUCB1(scores, visits, size, GetParentTerm(tables, total_visits));
+        }
+        const auto parent_term = GetParentTerm(tables, total_visits);
+        uint32_t best = 0;
+        auto best_ucb = Evaluate(tables, scores[0], visits[0], parent_term);
+        for (uint32_t i = 1; i < size; ++i) {
+            const auto ucb = Evaluate(tables, scores[i], visits[i], parent_term);
+            if (best_ucb > ucb) {
+                best_ucb = ucb;
+                best = i;
+            }
+        }
+        return best;
+    }
+
 private:
-    static double DefaultConstant() noexcept {      
+    static double DefaultConstant() noexcept {
         return 1.41421;
     }
     double score_;
     int64_t visits_;
 };
 
-// Upper Confidence Bounds Tuned
+// Upper Confidence Bounds Tuned. Keeps the squared deviations of the rewards
+// (kTracksSquares) for the variance bound.
 class UCB1TunedPolicy {
 public:
+    static constexpr bool kTracksSquares = true;
+    static constexpr double kMaxBernoulliVariance = 0.25;
+    static constexpr double kSqrt2 = 1.4142135623730951;
+
     UCB1TunedPolicy() noexcept
         : score_(0)
         , visits_(0)
-        , sqrt_score_(0) {
+        , deviations_(0) {
     }
 
     [[nodiscard]] double GetScore() const noexcept {
@@ -61,24 +260,71 @@ public:
         return visits_;
     }
 
-	void Update(double score, int32_t visits) noexcept {
-		score_ += score;
-		sqrt_score_ += sqrt_score_ * sqrt_score_;
-		visits_ += visits;
-	}
+    [[nodiscard]] double GetDeviations() const noexcept {
+        return deviations_;
+    }
+
+    void Update(const RewardStats& rewards) noexcept {
+        Accumulate(score_, visits_, deviations_, rewards);
+    }
+
+    // Same as DefaultUCB1Policy::AddVirtualVisits(). The deviations are left
+    // alone; a merge while visits are pending takes their wins into the mean
+    // it measures the new rewards against.
+    void AddVirtualVisits(int32_t visits) noexcept {
+        score_ += visits;
+        visits_ += visits;
+    }
+
+    double operator()(const VisitTables& tables, double parent_term) const {
+        return Evaluate(tables, score_, visits_, deviations_, parent_term);
+    }
+
+    static void Accumulate(double& score_sum, int64_t& visits_sum, double& deviations, const RewardStats& rewards) noexcept {
+        RewardStats::Merge(score_sum, visits_sum, deviations, rewards);
+    }
+
+    // sqrt(log(parent_visits))
+    static double GetParentTerm(const VisitTables& tables, int64_t parent_visits) noexcept {
+        return std::sqrt(tables.Log(parent_visits));
+    }
+
+    // score / visits + sqrt(log(parent_visits) / visits * min(1/4, V)), with
+    // V = variance + sqrt(2 log(parent_visits) / visits); -infinity without
+    // visits, as in DefaultUCB1Policy::Evaluate().
+    static double Evaluate(const VisitTables& tables, double score, int64_t visits, double deviations, double parent_term) noexcept {
+        if (visits == 0) {
+            return -std::numeric_limits<double>::infinity();
+        }
+        const auto inv_sqrt_visits = tables.InvSqrt(visits);
+        const auto V = deviations / visits + kSqrt2 * parent_term * inv_sqrt_visits;
+        return (score / visits)
+                + parent_term * inv_sqrt_visits
+                * std::sqrt((std::min)(kMaxBernoulliVariance, V));
+    }
 
-    double operator()(double parent_visits) const {
-        const auto MAX_BERNOULLI_RANDOM_VARIABLE_VARIANCE = 0.25;
-        const auto V = sqrt_score_ / visits_ - std::pow(sqrt_score_ / visits_, 2) + std::sqrt(2 * std::log(parent_visits) / visits_);
-        return (score_ / visits_)
-                + std::sqrt(std::log(parent_visits) / visits_)
-                * (std::min)(MAX_BERNOULLI_RANDOM_VARIABLE_VARIANCE, V);
+    // Same as DefaultUCB1Policy::SelectChild().
+    static uint32_t SelectChild(const VisitTables& tables, const double* scores, const int64_t* visits, const double* deviations, uint32_t size, int64_t parent_visits) noexcept {
+        if (size >= ucb_kernel::kLanes && ucb_kernel::HasAVX2()) {
+            return ucb_kernel::SelectUCB1Tuned(scores, visits, deviations, size, GetParentTerm(tables, parent_visits), kSqrt2, kMaxBernoulliVariance);
+        }
+        const auto parent_term = GetParentTerm(tables, parent_visits);
+        uint32_t best = 0;
+        auto best_ucb = Evaluate(tables, scores[0], visits[0], deviations[0], parent_term);
+        for (uint32_t i = 1; i < size; ++i) {
+            const auto ucb = Evaluate(tables, scores[i], visits[i], deviations[i], parent_term);
+            if (best_ucb > ucb) {
+                best_ucb = ucb;
+                best = i;
+            }
+        }
+        return best;
     }
 
 private:
     double score_;
     int64_t visits_;
-    double sqrt_score_;
+    double deviations_;
 };
 
 }
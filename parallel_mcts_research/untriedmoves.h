@@ -0,0 +1,211 @@
+// Copyright (c) 2019 ParallelMCTSResearch project.
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <iterator>
+#include <type_traits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "tweakme.h"
+#include "rng.h"
+
+namespace mcts {
+
+// Maps the moves of a game onto [0, kSize). Games specialize it to use the
+// fixed-width untried-move containers:
+//
+// template <>
+// struct MoveIndexTraits<MyMove> {
+//     static constexpr uint32_t kSize = ...;
+//     static uint32_t ToIndex(const MyMove& move) noexcept;
+//     static MyMove FromIndex(uint32_t index) noexcept;
+// };
+template <typename Move>
+struct MoveIndexTraits;
+
+inline uint32_t PopCount(uint64_t word) noexcept {
+#ifdef _MSC_VER
+    return static_cast<uint32_t>(__popcnt64(word));
+#else
+    return static_cast<uint32_t>(__builtin_popcountll(word));
+#endif
+}
+
+inline uint32_t CountTrailingZero(uint64_t word) noexcept {
+#ifdef _MSC_VER
+    unsigned long index = 0;
+    _BitScanForward64(&index, word);
+    return static_cast<uint32_t>(index);
+#else
+    return static_cast<uint32_t>(__builtin_ctzll(word));
+#endif
+}
+
+// Copy of State::GetLegalMoves(). Works for any move type with std::hash,
+// but every node owns a hash table and a random pick walks the table.
+template <typename Move>
+class HashSetMoves {
+public:
+    template <typename State>
+    explicit HashSetMoves(const State& state)
+        : moves_(state.GetLegalMoves()) {
+    }
+
+    [[nodiscard]] bool IsEmpty() const noexcept {
+        return moves_.empty();
+    }
+
+    [[nodiscard]] uint32_t GetSize() const noexcept {
+        return static_cast<uint32_t>(moves_.size());
+    }
+
+    void Erase(const Move& move) {
+        moves_.erase(move);
+    }
+
+    Move TakeRandom() {
+        auto itr = std::next(std::begin(moves_), RNG::Get()(0, static_cast<int32_t>(moves_.size() - 1)));
+        auto move = *itr;
+        moves_.erase(itr);
+        return move;
+    }
+
+    [[nodiscard]] size_t GetHeapBytes() const noexcept {
+        return GetHashSetBytes(moves_);
+    }
+
+private:
+    HashSet<Move> moves_;
+};
+
+// One bit per move index, no heap allocation.
+template <typename Move>
+class BitsetMoves {
+public:
+    using index_traits = MoveIndexTraits<Move>;
+
+    static constexpr uint32_t kWords = (index_traits::kSize + 63) / 64;
+
+    template <typename State>
+    explicit BitsetMoves(const State& state) noexcept
+        : size_(0)
+        , words_() {
+        for (const auto& move : state.GetLegalMoves()) {
+            const auto index = index_traits::ToIndex(move);
+            words_[index / 64] |= uint64_t(1) << (index % 64);
+            ++size_;
+        }
+    }
+
+    [[nodiscard]] bool IsEmpty() const noexcept {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] uint32_t GetSize() const noexcept {
+        return size_;
+    }
+
+    void Erase(const Move& move) noexcept {
+        const auto index = index_traits::ToIndex(move);
+        const auto mask = uint64_t(1) << (index % 64);
+        if (words_[index / 64] & mask) {
+            words_[index / 64] &= ~mask;
+            --size_;
+        }
+    }
+
+    Move TakeRandom() noexcept {
+        auto nth = RNG::Get()(static_cast<uint32_t>(0), size_ - 1);
+        for (uint32_t i = 0; i < kWords; ++i) {
+            const auto count = PopCount(words_[i]);
+            if (nth >= count) {
+                nth -= count;
+                continue;
+            }
+            auto word = words_[i];
+            for (; nth > 0; --nth) {
+                word &= word - 1;
+            }
+            const auto bit = CountTrailingZero(word);
+            words_[i] &= ~(uint64_t(1) << bit);
+            --size_;
+            return index_traits::FromIndex(i * 64 + bit);
+        }
+        return Move();
+    }
+
+private:
+    uint32_t size_;
+    std::array<uint64_t, kWords> words_;
+};
+
+// Dense array of move indices with swap-remove, plus the position of every
+// move in that array. Meant for small boards.
+template <typename Move>
+class DenseMoves {
+public:
+    using index_traits = MoveIndexTraits<Move>;
+    using slot_type = std::conditional_t<(index_traits::kSize < 256), uint8_t, uint16_t>;
+
+    static constexpr slot_type kAbsent = static_cast<slot_type>(~slot_type(0));
+
+    template <typename State>
+    explicit DenseMoves(const State& state) noexcept
+        : size_(0) {
+        positions_.fill(kAbsent);
+        for (const auto& move : state.GetLegalMoves()) {
+            const auto index = index_traits::ToIndex(move);
+            positions_[index] = size_;
+            moves_[size_++] = static_cast<slot_type>(index);
+        }
+    }
+
+    [[nodiscard]] bool IsEmpty() const noexcept {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] uint32_t GetSize() const noexcept {
+        return size_;
+    }
+
+    void Erase(const Move& move) noexcept {
+        const auto index = index_traits::ToIndex(move);
+        if (positions_[index] != kAbsent) {
+            EraseAt(positions_[index]);
+        }
+    }
+
+    Move TakeRandom() noexcept {
+        const auto position = RNG::Get()(static_cast<uint32_t>(0), static_cast<uint32_t>(size_) - 1);
+        const auto index = moves_[position];
+        EraseAt(static_cast<slot_type>(position));
+        return index_traits::FromIndex(index);
+    }
+
+private:
+    void EraseAt(slot_type position) noexcept {
+        const auto index = moves_[position];
+        const auto last = moves_[--size_];
+        moves_[position] = last;
+        positions_[last] = position;
+        positions_[index] = kAbsent;
+    }
+
+    slot_type size_;
+    std::array<slot_type, index_traits::kSize> moves_;
+    std::array<slot_type, index_traits::kSize> positions_;
+};
+
+// Selects the untried-move container for a game. Games with a
+// MoveIndexTraits specialization can switch to BitsetMoves or DenseMoves.
+template <typename Move>
+struct UntriedMovesTraits {
+    using type = HashSetMoves<Move>;
+};
+
+}